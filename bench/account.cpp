@@ -0,0 +1,93 @@
+/*
+ * Account hot path benchmark.
+ *
+ * Runs AB (balance) and AD (deposit) loops against a scratch database, once
+ * passing the SQL text to sqlite_modern_cpp on every call as Account used to,
+ * and once through Account, whose statements are prepared once and kept.
+ * Both variants of a loop use the same connection, the reader for AB and the
+ * writer for AD.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <vector>
+#include "config.hpp"
+#include "database/account.hpp"
+#include "database/singleton.hpp"
+
+const int ACCOUNTS = 1000;
+const int OPERATIONS = 200000;
+
+double opsPerSecond(int operations, const std::function<void(int)>& operation)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int index = 0; index < operations; ++index)
+	{
+		operation(index);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return operations / seconds;
+}
+
+int main()
+{
+	// The database lives in the working directory, so work somewhere it can be thrown away
+	std::filesystem::path scratch = std::filesystem::temp_directory_path() / "interbanqa_bench_account";
+	std::filesystem::remove_all(scratch);
+	std::filesystem::create_directories(scratch);
+	std::filesystem::current_path(scratch);
+
+	// Commits every change on its own, as the SQL text loops do
+	config::DB_DURABILITY = "op";
+	// Account::get reads through the only reader then, so both AB loops run on the same connection, as both AD loops
+	// run on the writer
+	config::DB_READERS = 1;
+	auto singleton = DBSingleton::instance();
+	// Measures statements, not the disk, which would otherwise drown the difference for AD
+	*singleton->writer->db << "pragma synchronous = off;";
+	std::vector<int> numbers;
+	for (int index = 0; index < ACCOUNTS; ++index)
+	{
+		numbers.emplace_back(Account::create().number());
+	}
+
+	double textBalance = opsPerSecond(OPERATIONS, [&](int index)
+	{
+		long long int balance;
+		std::unique_lock<std::mutex> lock;
+		DBConnection& reader = singleton->reader(lock);
+		*reader.db << "select id, balance from Account where id = ?" << numbers[index % ACCOUNTS] >> [&](int, long long int value)
+		{
+			balance = value;
+		};
+	});
+	double cachedBalance = opsPerSecond(OPERATIONS, [&](int index)
+	{
+		Account::get(numbers[index % ACCOUNTS]).balance();
+	});
+	double textDeposit = opsPerSecond(OPERATIONS, [&](int index)
+	{
+		long long int balance;
+		std::lock_guard<std::mutex> lock(singleton->writer->mutex);
+		*singleton->writer->db << "update Account set balance = balance + ? where id = ? and balance <= ? returning balance;" << 1LL << numbers[index % ACCOUNTS] << std::numeric_limits<long long int>::max() - 1 >> [&](long long int value)
+		{
+			balance = value;
+		};
+	});
+	double cachedDeposit = opsPerSecond(OPERATIONS, [&](int index)
+	{
+		Account::deposit(numbers[index % ACCOUNTS], 1);
+	});
+
+	std::printf("%d operations over %d accounts\n\n", OPERATIONS, ACCOUNTS);
+	std::printf("%8s %16s %16s %8s\n", "command", "SQL text ops/s", "cached ops/s", "speedup");
+	std::printf("%8s %16.0f %16.0f %7.2fx\n", "AB", textBalance, cachedBalance, cachedBalance / textBalance);
+	std::printf("%8s %16.0f %16.0f %7.2fx\n", "AD", textDeposit, cachedDeposit, cachedDeposit / textDeposit);
+
+	std::filesystem::current_path(std::filesystem::temp_directory_path());
+	std::filesystem::remove_all(scratch);
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Robbery planner benchmark.
+ *
+ * Plans over synthetic networks of increasing size, for small, medium and
+ * large targets, and compares the clients affected against the greedy plan
+ * RP used to make.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "planner.hpp"
+
+const size_t BANK_COUNTS[] = { 10, 100, 1000, 10000 };
+const double TARGET_SHARES[] = { 0.1, 0.5, 0.9 };
+const int RUNS = 20;
+
+std::vector<Bank> network(size_t count, std::mt19937_64& random)
+{
+	std::uniform_int_distribution<int> clients(1, 2000);
+	std::uniform_int_distribution<long long int> perClient(0, 100000);
+	std::vector<Bank> res(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		res[index].address = "10.0." + std::to_string(index / 256) + "." + std::to_string(index % 256);
+		res[index].clients = clients(random);
+		// Some banks are rich, most aren't
+		res[index].balance = res[index].clients * perClient(random) * (random() % 10 == 0 ? 10 : 1);
+	}
+	return res;
+}
+
+double milliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+	std::mt19937_64 random(42);
+
+	std::printf("Average of %d runs per row\n\n", RUNS);
+	std::printf("%8s %8s %12s %12s %16s %16s\n", "banks", "target", "greedy ms", "planner ms", "greedy clients", "planner clients");
+	for (size_t count : BANK_COUNTS)
+	{
+		std::vector<Bank> banks = network(count, random);
+		long long int total = 0;
+		for (auto& bank : banks) total += bank.balance;
+
+		for (double share : TARGET_SHARES)
+		{
+			long long int target = total * share;
+
+			auto start = std::chrono::steady_clock::now();
+			RobberyPlan greedy;
+			for (int run = 0; run < RUNS; ++run) greedy = Planner::greedy(banks, target);
+			double greedyTime = milliseconds(start) / RUNS;
+
+			start = std::chrono::steady_clock::now();
+			RobberyPlan plan;
+			for (int run = 0; run < RUNS; ++run) plan = Planner::plan(banks, target);
+			double planTime = milliseconds(start) / RUNS;
+
+			std::printf("%8zu %7.0f%% %12.3f %12.3f %16lld %16lld\n", count, share * 100, greedyTime, planTime, greedy.clients, plan.clients);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Packet queue microbenchmark.
+ *
+ * Compares the old std::vector + erase(begin()) queue against RingQueue,
+ * for bursts of pipelined packets (fill to depth, then drain) and for a
+ * producer and a consumer thread running at the same time.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "networking/packet.hpp"
+#include "networking/ringqueue.hpp"
+
+const size_t TOTAL_PACKETS = 1 << 18;
+const size_t DEPTHS[] = { 16, 64, 256, 1024, 4096 };
+
+class VectorQueue
+{
+private:
+	std::vector<Packet> packets;
+	std::mutex locker;
+	size_t depth;
+
+public:
+	VectorQueue(size_t depth) : depth(depth)
+	{
+	}
+
+	bool push(const Packet& packet)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (packets.size() >= depth) return false;
+		packets.emplace_back(packet);
+		return true;
+	}
+	bool pop(Packet& packet)
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (packets.empty()) return false;
+		packet = packets[0];
+		packets.erase(packets.begin());
+		return true;
+	}
+};
+
+double seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Queue>
+double burst(Queue& queue, size_t depth, const Packet& packet)
+{
+	auto start = std::chrono::steady_clock::now();
+	Packet out;
+	for (size_t done = 0; done < TOTAL_PACKETS; done += depth)
+	{
+		for (size_t index = 0; index < depth; ++index) queue.push(packet);
+		while (queue.pop(out)) {}
+	}
+	return TOTAL_PACKETS / seconds(start) / 1e6;
+}
+
+double burstBatched(RingQueue<Packet>& queue, size_t depth, const Packet& packet)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Packet> out;
+	out.reserve(depth);
+	for (size_t done = 0; done < TOTAL_PACKETS; done += depth)
+	{
+		for (size_t index = 0; index < depth; ++index) queue.push(packet);
+		while (queue.popBatch(out, depth) > 0) out.clear();
+	}
+	return TOTAL_PACKETS / seconds(start) / 1e6;
+}
+
+template<typename Queue>
+double threaded(Queue& queue, const Packet& packet)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&]()
+	{
+		for (size_t index = 0; index < TOTAL_PACKETS; ++index)
+		{
+			while (!queue.push(packet)) std::this_thread::yield();
+		}
+	});
+	Packet out;
+	for (size_t received = 0; received < TOTAL_PACKETS;)
+	{
+		if (queue.pop(out)) ++received;
+		else std::this_thread::yield();
+	}
+	producer.join();
+	return TOTAL_PACKETS / seconds(start) / 1e6;
+}
+
+int main()
+{
+	Packet packet(Buffer("AD 10000/10.0.0.1 100"), nullptr);
+
+	std::printf("Throughput in millions of packets per second, %zu packets per run\n\n", TOTAL_PACKETS);
+	std::printf("%8s %14s %14s %14s %14s %14s\n", "depth", "vector burst", "ring burst", "ring batched", "vector 2-thr", "ring 2-thr");
+	for (size_t depth : DEPTHS)
+	{
+		VectorQueue vector(depth);
+		RingQueue<Packet> ring(depth);
+		double vectorBurst = burst(vector, depth, packet);
+		double ringBurst = burst(ring, depth, packet);
+		double ringBatched = burstBatched(ring, depth, packet);
+		double vectorThreaded = threaded(vector, packet);
+		double ringThreaded = threaded(ring, packet);
+		std::printf("%8zu %14.2f %14.2f %14.2f %14.2f %14.2f\n", depth, vectorBurst, ringBurst, ringBatched, vectorThreaded, ringThreaded);
+	}
+	return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <set>
 #include <string>
+#include "cancellation.hpp"
 
 class Bank
 {
@@ -10,12 +11,18 @@ public:
 	std::string address = "0.0.0.0";
 	long long int balance = 0;
 	int clients = 0;
+	/// The bank's state version as of the BS response, 0 if it answered BA and BN instead.
+	unsigned long long int version = 0;
 
 	double balancePerClient() const;
 
 	bool operator<(const Bank& other) const;
 
-	static std::multiset<Bank> listBanks();
+	/**
+	 * @return Every bank in the network, from the BankDirectory if it's ready, otherwise by sweeping the network,
+	 *         along with what Gossip knows, if it's ready.
+	 */
+	static std::multiset<Bank> listBanks(const CancellationToken& token = CancellationToken());
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef BANKDIRECTORY_HPP
+#define BANKDIRECTORY_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "bank.hpp"
+#include "cancellation.hpp"
+
+/**
+ * The banks known to live in the network, kept up to date by a background crawler.
+ *
+ * Every config::CRAWL_INTERVAL milliseconds (with some jitter), the crawler probes at most config::CRAWL_BATCH addresses:
+ * known banks whose figures are older than config::CRAWL_REFRESH seconds first, then the next addresses of the network,
+ * going round and round. Once Discovery is ready, only the banks it found are probed, each on its own port.
+ * Network-wide queries are then answered from memory instead of sweeping the network.
+ *
+ * So that doesn't wait for the crawler to come round the whole network once, the directory is seeded by a single
+ * Scanner pass over all of it when the crawler starts, a random part of config::CRAWL_INTERVAL later. The pass probes
+ * config::CRAWL_BATCH targets at once, and is given up on after config::CRAWL_REFRESH seconds, leaving the rest to
+ * the rounds.
+ */
+class BankDirectory
+{
+private:
+	struct Entry
+	{
+		Bank bank;
+		std::chrono::steady_clock::time_point refreshed;
+	};
+
+	BankDirectory();
+
+	std::unordered_map<std::string, Entry> entries;
+	/// Next address of the network to look at, in [firstAddress, lastAddress).
+	uint32_t cursor = 0;
+	uint32_t firstAddress = 0;
+	uint32_t lastAddress = 0;
+	/// Whether the crawler went through the whole network at least once.
+	bool complete = false;
+
+	std::thread crawler;
+	bool running = false;
+	CancellationToken crawling;
+	std::mt19937 random;
+	std::mutex directoryLocker;
+	std::condition_variable directoryCondition;
+
+	/**
+	 * The crawler's loop.
+	 */
+	void crawl();
+	friend void crawlerThread(BankDirectory* directory);
+	/**
+	 * Probes every address of the network in one throttled pass, and records what was found.
+	 */
+	void seed();
+	/**
+	 * Probes the next batch of addresses and records what was found.
+	 */
+	void round();
+
+	static std::shared_ptr<BankDirectory> _instance;
+
+public:
+	~BankDirectory();
+
+	/**
+	 * Starts the crawler, unless disabled by config::CRAWL.
+	 */
+	void start();
+	/**
+	 * Stops the crawler, abandoning the round in progress.
+	 */
+	void stop();
+
+	/**
+	 * @return Whether the whole network was seeded or crawled at least once, so banks() can be trusted to list every bank.
+	 */
+	bool ready();
+	/**
+	 * @return Every known bank, as of its last refresh.
+	 */
+	std::vector<Bank> banks();
+
+	static std::shared_ptr<BankDirectory> instance();
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef CANCELLATION_HPP
+#define CANCELLATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Tells work that its result is no longer wanted. Copies share the same state, so a token can be handed down to
+ * whatever does the work, while the one who started it keeps a copy to cancel.
+ *
+ * A token also counts as cancelled once its deadline passes. Callbacks only run on cancel() though,
+ * so whoever blocks should wait no longer than deadline().
+ */
+class CancellationToken
+{
+private:
+	struct State
+	{
+		std::atomic<bool> cancelled = false;
+		std::chrono::steady_clock::time_point deadline;
+		std::mutex locker;
+		std::unordered_map<size_t, std::function<void()>> callbacks;
+		size_t nextId = 1;
+
+		/// The token this one was derived from, unsubscribed from when this one goes away.
+		std::weak_ptr<State> parent;
+		size_t parentId = 0;
+
+		~State();
+	};
+
+	std::shared_ptr<State> state;
+
+	CancellationToken(std::shared_ptr<State> state);
+
+public:
+	/**
+	 * A token without a deadline.
+	 */
+	CancellationToken();
+	CancellationToken(std::chrono::steady_clock::time_point deadline);
+	/**
+	 * A token cancelled along with parent, with a deadline no later than the parent's.
+	 */
+	CancellationToken(const CancellationToken& parent, std::chrono::steady_clock::time_point deadline);
+	CancellationToken(const CancellationToken& other) = default;
+	CancellationToken& operator=(const CancellationToken& other) = default;
+
+	/**
+	 * Cancels the token and runs the registered callbacks. Only the first call does anything.
+	 */
+	void cancel() const;
+	/**
+	 * @return Whether the token was cancelled or its deadline passed.
+	 */
+	bool cancelled() const;
+	/**
+	 * Throws InterbanqaException if cancelled().
+	 */
+	void check() const;
+	std::chrono::steady_clock::time_point deadline() const;
+
+	/**
+	 * Registers a callback run by cancel(). If the token is already cancelled, the callback runs right away.
+	 * Callbacks must not block, they're usually called from the Reactor.
+	 *
+	 * @return An id for unsubscribe(), 0 if the callback already ran.
+	 */
+	size_t subscribe(std::function<void()> callback) const;
+	void unsubscribe(size_t id) const;
+};
+
+/**
+ * Keeps a callback registered on a token for as long as it lives.
+ */
+class CancellationSubscription
+{
+private:
+	CancellationToken token;
+	size_t id;
+
+public:
+	CancellationSubscription(const CancellationToken& token, std::function<void()> callback);
+	CancellationSubscription(const CancellationSubscription& other) = delete;
+	CancellationSubscription& operator=(const CancellationSubscription& other) = delete;
+	~CancellationSubscription();
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef CIRCUITBREAKER_HPP
+#define CIRCUITBREAKER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "cancellation.hpp"
+
+/**
+ * Remembers addresses where no bank answered, so requests forwarded there fail right away instead of sweeping every
+ * port until config::TIMEOUT.
+ *
+ * Once a forward finds no bank, because every port refused the connection or answered as no bank would, the
+ * address's circuit opens; ports that merely time out don't open it. Requests to the address are refused until a
+ * background probe finds a bank there again. Probes wait config::BREAKER_BACKOFF milliseconds, doubling after every
+ * failed probe up to config::BREAKER_BACKOFF_MAX.
+ */
+class CircuitBreaker
+{
+private:
+	struct Circuit
+	{
+		/// Failures in a row, the forward that opened the circuit included.
+		int failures = 0;
+		std::chrono::steady_clock::time_point retry;
+		bool probing = false;
+	};
+
+	CircuitBreaker();
+
+	/// Open circuits, by address.
+	std::unordered_map<std::string, Circuit> open;
+
+	std::thread prober;
+	bool running = false;
+	CancellationToken probing;
+	std::mutex breakerLocker;
+	std::condition_variable breakerCondition;
+
+	/**
+	 * The prober's loop: waits for circuits due to be probed, and probes them.
+	 */
+	void probe();
+	friend void proberThread(CircuitBreaker* breaker);
+	/**
+	 * Schedules the next probe of a circuit that failed once more. Expects breakerLocker to be held.
+	 */
+	void backOff(Circuit& circuit);
+
+	static std::shared_ptr<CircuitBreaker> _instance;
+
+public:
+	~CircuitBreaker();
+
+	/**
+	 * Starts probing open circuits, unless disabled by config::BREAKER_BACKOFF being 0.
+	 */
+	void start();
+	/**
+	 * Stops probing, abandoning the probes in progress.
+	 */
+	void stop();
+
+	/**
+	 * @return Whether requests may be forwarded to the address, i.e. its circuit isn't open.
+	 */
+	bool allow(const std::string& address);
+	/**
+	 * Records that no bank answered at the address, opening its circuit.
+	 */
+	void failed(const std::string& address);
+	/**
+	 * Records that a bank answered at the address, closing its circuit.
+	 */
+	void succeeded(const std::string& address);
+
+	static std::shared_ptr<CircuitBreaker> instance();
+};
+
+#endif
@@ -4,35 +4,74 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include "cancellation.hpp"
 
 class Socket;
+class Packet;
 
-class Client
+class Client : public std::enable_shared_from_this<Client>
 {
 private:
+	struct Request;
+
 	std::shared_ptr<Socket> socket;
+	std::string address;
+
+	/// Requests being executed. Unless multiplexed, that's at most one, so responses keep their order.
+	size_t running = 0;
+	std::mutex clientLocker;
+	/**
+	 * Set once the peer negotiated request IDs with XM. From then on, every request and response starts with "#id ",
+	 * and up to config::MAX_INFLIGHT requests run at once, answering in whatever order they finish.
+	 */
+	std::atomic<bool> multiplexed = false;
 
 	void respond(const std::string& message);
+	/**
+	 * Starts handling pending packets, as long as there's room for more running requests.
+	 */
+	void advance();
+	/**
+	 * Answers the packet right away (including the XM negotiation), or submits its command to the WorkerPool.
+	 *
+	 * @return Whether the command was submitted, and finish() will be called for it.
+	 */
+	bool start(const Packet& packet);
+	/**
+	 * Responds to a submitted request, once. Called by the worker and by the timeout, whichever comes first.
+	 */
+	void finish(std::shared_ptr<Request> request, const std::string& response);
 
-	static std::string bankCode(const std::vector<std::string>& arguments);
-	static std::string accountCreate(const std::vector<std::string>& arguments);
-	static std::string accountDeposit(const std::vector<std::string>& arguments);
-	static std::string accountWithdrawal(const std::vector<std::string>& arguments);
-	static std::string accountBalance(const std::vector<std::string>& arguments);
-	static std::string accountRemove(const std::vector<std::string>& arguments);
-	static std::string bankTotalAmount(const std::vector<std::string>& arguments);
-	static std::string bankNumberOfClients(const std::vector<std::string>& arguments);
-	static std::string robberyPlan(const std::vector<std::string>& arguments);
+	static std::string bankCode(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string accountCreate(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string accountDeposit(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string accountWithdrawal(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string accountBalance(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string accountRemove(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string bankTotalAmount(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string bankNumberOfClients(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string bankStatistics(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string bankGossip(const std::vector<std::string>& arguments, const CancellationToken& token);
+	static std::string robberyPlan(const std::vector<std::string>& arguments, const CancellationToken& token);
 
-	static std::unordered_map<std::string, std::string(*)(const std::vector<std::string>& arguments)> commands;
+	static std::unordered_map<std::string, std::string(*)(const std::vector<std::string>& arguments, const CancellationToken& token)> commands;
 
 public:
-	static std::string forwardRequest(const std::vector<std::string>& arguments, std::string address);
+	/**
+	 * Sends the request to every port of the address at once, returning the first answer.
+	 * The remaining attempts are cancelled as soon as there's an answer, or once the token is cancelled.
+	 */
+	static std::string forwardRequest(const std::vector<std::string>& arguments, std::string address, const CancellationToken& token = CancellationToken());
 
 	Client(std::shared_ptr<Socket> socket);
 
-	void run();
+	/**
+	 * Called by the Socket whenever a packet arrives or its outgoing queue drains.
+	 */
+	void notify();
 };
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define CONFIG_JSON
 
 #include <string>
+#include <vector>
 
 namespace config
 {
@@ -11,6 +12,80 @@ namespace config
 	extern std::string ADDRESS;
 	extern int PREFIX_LENGTH;
 	extern double TIMEOUT;
+
+	/// Threads driving the shared network event loop. 0 means one per CPU core.
+	extern int IO_THREADS;
+	/// Threads executing client commands.
+	extern int WORKER_THREADS;
+	/// Maximum amount of commands waiting for a worker thread. Further commands are answered with ER busy.
+	extern int WORKER_QUEUE;
+	/// Maximum amount of received packets queued per connection before it stops reading.
+	extern int QUEUE_DEPTH;
+	/// Amount of unsent response bytes per connection, above which no new requests are started until the peer catches up.
+	extern int SEND_HIGH_WATER;
+	/// Maximum amount of open client connections in total. Further connections are rejected with ER busy.
+	extern int MAX_CONNECTIONS;
+	/// Maximum amount of open client connections from one IP address.
+	extern int MAX_CONNECTIONS_PER_IP;
+	/// Maximum amount of requests per connection that are queued or being handled. Further requests are answered with ER busy.
+	extern int MAX_INFLIGHT;
+	/// Seconds a known bank port is trusted for forwarding. 0 disables the port directory.
+	extern int PORT_CACHE_TTL;
+	/// File the port directory is kept in across restarts. Empty means it isn't kept.
+	extern std::string PORT_CACHE_PATH;
+	/// Maximum amount of idle connections kept open to each peer bank.
+	extern int PEER_POOL_SIZE;
+	/// Seconds an idle connection to a peer bank is kept open.
+	extern int PEER_IDLE_TIMEOUT;
+	/// Whether to negotiate request IDs with peer banks, sharing a single connection between forwarded requests.
+	extern bool PEER_MULTIPLEX;
+	/// Maximum amount of ports probed at once when looking for banks in the network.
+	extern int SCAN_CONCURRENCY;
+	/// Milliseconds a single port is given to answer when looking for banks.
+	extern int SCAN_PROBE_TIMEOUT;
+	/// Whether to keep crawling the network for banks in the background.
+	extern bool CRAWL;
+	/// Milliseconds between crawler rounds.
+	extern int CRAWL_INTERVAL;
+	/// Maximum amount of addresses probed per crawler round.
+	extern int CRAWL_BATCH;
+	/// Seconds after which the crawler probes a known bank again.
+	extern int CRAWL_REFRESH;
+	/// Whether to exchange bank figures with other nodes in the background, gossip style.
+	extern bool GOSSIP;
+	/// Milliseconds between gossip rounds.
+	extern int GOSSIP_INTERVAL;
+	/// Peers gossiped with per round.
+	extern int GOSSIP_FANOUT;
+	/// Whether to find banks on the LAN with UDP datagrams instead of connecting to every port of every address.
+	extern bool DISCOVERY;
+	/// Multicast (or broadcast) address discovery datagrams are sent to.
+	extern std::string DISCOVERY_GROUP;
+	/// UDP port discovery datagrams are sent to, shared by every node on the LAN.
+	extern int DISCOVERY_PORT;
+	/// Seconds between announcements of this node to the group.
+	extern int DISCOVERY_INTERVAL;
+	/// Milliseconds before an address where no bank answered is probed again, doubling after every failed probe. 0 disables the circuit breaker.
+	extern int BREAKER_BACKOFF;
+	/// Upper bound on BREAKER_BACKOFF's doubling.
+	extern int BREAKER_BACKOFF_MAX;
+	/// Whether to send read-only forwarded requests once more when the bank is slower than usual to answer.
+	extern bool HEDGE;
+	/// Percentile of a bank's round trip times after which a read-only request is sent once more.
+	extern int HEDGE_PERCENTILE;
+	/// Read-only database connections answering queries alongside the writer. 0 means one per CPU core.
+	extern int DB_READERS;
+	/// SQLite's synchronous level for writes: "off", "normal", "full" or "extra".
+	extern std::string DB_SYNCHRONOUS;
+	/// Pages the write-ahead log may grow to before it's copied into the database. 0 means only on shutdown.
+	extern int DB_CHECKPOINT;
+	/// When deposits, withdrawals and other changes are answered: "op" once each is committed on its own, "group" once
+	/// the batch it was collected into is, "async" right away, before the batch is.
+	extern std::string DB_DURABILITY;
+	/// Milliseconds a batch of changes collects more before it's committed.
+	extern int DB_COMMIT_WINDOW;
+	/// "address:port" of banks always known, whether or not discovery reaches them.
+	extern std::vector<std::string> SEEDS;
 }
 
 /**
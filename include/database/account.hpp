@@ -1,6 +1,19 @@
 #ifndef ACCOUNT_HPP
 #define ACCOUNT_HPP
 
+class DBConnection;
+
+/**
+ * Funds, client count and state version of the bank, read together.
+ */
+struct BankStatistics
+{
+	long long int funds;
+	long long int clients;
+	/// Changes whenever an account is created, removed or changes balance. Also differs between runs.
+	unsigned long long int version;
+};
+
 class Account
 {
 private:
@@ -8,23 +21,52 @@ private:
 	long long int _balance;
 
 	static void checkNumber(int number);
-	static bool has(int number);
+	/**
+	 * Throws "Account doesn't exist" unless it does. Expects a change to be in progress.
+	 */
+	static void checkExists(int number);
+	/**
+	 * Marks the bank's state as changed, adding to the running totals. Expects a change to be in progress.
+	 */
+	static void changed(long long int funds, long long int clients);
+	/**
+	 * Sets the running totals to what the Account table says. Expects the writer's mutex to be held.
+	 */
+	static void recount(DBConnection& writer);
 
 	Account();
 
 public:
 	static Account create();
+	/**
+	 * Removes an account, provided it's empty.
+	 */
 	static void remove(int number);
 	static Account get(int number);
-	void save();
 
 	int number();
 	long long int balance();
-	void deposit(long long int amount);
-	void withdraw(long long int amount);
+	/**
+	 * Adds to an account's balance in a single update, so concurrent deposits and withdrawals can't overwrite each
+	 * other.
+	 * @return The new balance.
+	 */
+	static long long int deposit(int number, long long int amount);
+	/**
+	 * Takes from an account's balance in a single update, which fails if the account doesn't have that much.
+	 * @return The new balance.
+	 */
+	static long long int withdraw(int number, long long int amount);
+
+	/**
+	 * Counts the running totals up from the Account table, and keeps them in step when changes are rolled back.
+	 * Must be called at startup, before count(), funds() or statistics() are.
+	 */
+	static void reconcile();
 
 	static long long int count();
 	static long long int funds();
+	static BankStatistics statistics();
 };
 
 #endif
\ No newline at end of file
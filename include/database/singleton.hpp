@@ -1,10 +1,52 @@
 #ifndef SINGLETON_HPP
 #define SINGLETON_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "sqlite_modern_cpp.h"
 
+/**
+ * One connection to the database, with the statements prepared on it. Used by one thread at a time, holding mutex.
+ */
+class DBConnection
+{
+private:
+	/// Statements prepared by statement(), by their SQL. Finalised by the destructor, before db closes.
+	std::unordered_map<std::string, std::unique_ptr<sqlite::database_binder>> statements;
+
+public:
+	std::unique_ptr<sqlite::database> db;
+	std::mutex mutex;
+
+	DBConnection(const std::string& path, sqlite::OpenFlags flags);
+	~DBConnection();
+
+	/**
+	 * Prepares a statement once and keeps it for as long as the connection, so SQLite doesn't parse and plan it again
+	 * on every request. Expects mutex to be held until the statement is done with.
+	 * @return The statement, reset and ready to be bound.
+	 */
+	sqlite::database_binder& statement(const std::string& sql);
+};
+
+/**
+ * The database, in WAL mode: one connection writes, while a pool of read-only connections answer queries
+ * at the same time, without waiting for writes.
+ *
+ * Unless config::DB_DURABILITY is "op", changes are collected into batches, one transaction each, so many of them are
+ * flushed to disk together. A committer thread commits the batch as soon as the previous one is done, or
+ * config::DB_COMMIT_WINDOW milliseconds after it opened. In "group" mode, each change waits for its batch to be
+ * committed, in "async" mode it doesn't. There, new changes wait for a batch that's due instead, so however busy the
+ * writer is, an answered change is committed within the window and one flush.
+ */
 class DBSingleton
 {
 private:
@@ -12,13 +54,81 @@ private:
 
 	void reset();
 
+	std::vector<std::unique_ptr<DBConnection>> readers;
+	/// Where reader() starts looking for an idle reader, so they're used in turns.
+	std::atomic<size_t> nextReader = 0;
+
+	/// Whether the writer is in the middle of a batch. Changed holding both the writer's mutex and commitLocker.
+	bool collecting = false;
+	/// The batch changes go into, and changes in it so far. Guarded by the writer's mutex.
+	unsigned long long int batch = 1;
+	long long int batchChanges = 0;
+	/// The last batch committed, and the batches that couldn't be, with how many of the changes waiting for them are
+	/// yet to be told. Guarded by commitLocker.
+	unsigned long long int committed = 0;
+	std::unordered_map<unsigned long long int, long long int> failed;
+	/// Whether the committer is about to commit the batch, so no more changes go into it. Guarded by commitLocker.
+	bool due = false;
+	/// Rows changed in "async" mode that aren't committed yet, so only the writer sees them. Guarded by commitLocker.
+	std::unordered_set<long long int> pending;
+	std::thread committer;
+	bool committing = false;
+	std::mutex commitLocker;
+	std::condition_variable commitCondition;
+
+	/**
+	 * The committer's loop: waits for a batch, and commits it.
+	 */
+	void commit();
+	friend void committerThread(DBSingleton* singleton);
+	/**
+	 * Commits the batch being collected, if any. Expects the writer's mutex to be held.
+	 */
+	void commitBatch();
+
 	static std::shared_ptr<DBSingleton> _instance;
 
 public:
-	std::unique_ptr<sqlite::database> db;
-	std::mutex db_mutex;
+	~DBSingleton();
+
+	/// Called when a batch is rolled back, holding the writer's mutex, so whatever mirrors the database can catch up.
+	std::function<void(DBConnection& writer)> rolledBack;
+
+	/// The only connection that writes. Lock its mutex while using it, through beginChange() when changing anything.
+	std::unique_ptr<DBConnection> writer;
+
+	/**
+	 * Locks the writer for a change, adding it to the batch being collected.
+	 * @return The lock on the writer, to pass to endChange() once the change is made. Dropping it instead, e.g. when
+	 *         the change fails, is fine.
+	 */
+	std::unique_lock<std::mutex> beginChange();
+	/**
+	 * Releases the writer after a change, then waits until the change is durable as config::DB_DURABILITY says.
+	 * Throws if the batch couldn't be committed, in which case the change is lost.
+	 *
+	 * @param row The id of the row changed, which is read through the writer until it's committed, see uncommitted().
+	 */
+	void endChange(std::unique_lock<std::mutex>& lock, long long int row);
+	/**
+	 * @return Whether a change to the row was answered but isn't committed yet, so readers don't see it. Only ever
+	 *         true in "async" mode.
+	 */
+	bool uncommitted(long long int row);
+
+	/**
+	 * Picks a read-only connection, preferring an idle one, and locks it.
+	 * @param lock Holds the connection's mutex when this returns. Keep it for as long as the connection is used.
+	 */
+	DBConnection& reader(std::unique_lock<std::mutex>& lock);
+
+	/**
+	 * Copies the write-ahead log into the database and truncates it, waiting for readers and the writer to let it.
+	 * @return What was done, for the console.
+	 */
+	std::string checkpoint();
 
 	static std::shared_ptr<DBSingleton> instance();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,95 @@
+#ifndef DISCOVERY_HPP
+#define DISCOVERY_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "boost/asio.hpp"
+
+/// Longest datagram read. Anything beyond is cut off, and isn't a valid message anyway.
+const size_t MAX_DISCOVERY_DATAGRAM = 512;
+
+/**
+ * Finds the banks on the LAN with UDP datagrams sent to config::DISCOVERY_GROUP, instead of connecting to every port
+ * of every address.
+ *
+ * When started, the node asks the group with "DQ". Every node hearing that answers "DA address port" to the group, so
+ * the whole LAN learns of every bank within one round trip. Nodes also announce themselves every
+ * config::DISCOVERY_INTERVAL seconds, and say "DL address port" when stopping. Banks that miss three announcements in
+ * a row are forgotten.
+ *
+ * The group is a multicast address, or a broadcast one. Several nodes on one host share config::DISCOVERY_PORT.
+ * Discovered ports are fed to the PortDirectory. config::SEEDS are always listed among the peers, for banks that
+ * datagrams don't reach.
+ */
+class Discovery
+{
+private:
+	Discovery();
+
+	/// Banks that announced themselves, by "address:port", with when they last did.
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> announced;
+	/// When the group was asked, i.e. since when announcements have been coming.
+	std::chrono::steady_clock::time_point queried;
+	/// Whether another node's announcement came through. This node's own looping back proves nothing about the rest of the LAN.
+	bool heard = false;
+	bool running = false;
+	std::mutex discoveryLocker;
+
+	boost::asio::strand<boost::asio::io_context::executor_type> strand;
+	boost::asio::ip::udp::socket socket;
+	boost::asio::steady_timer timer;
+	boost::asio::ip::udp::endpoint group;
+	boost::asio::ip::udp::endpoint sender;
+	char datagram[MAX_DISCOVERY_DATAGRAM];
+
+	/**
+	 * Sends a message to the group. Runs on the strand.
+	 */
+	void send(const std::string& message);
+	/**
+	 * Reads the next datagram. Runs on the strand.
+	 */
+	void receive();
+	/**
+	 * Acts on a received message. Runs on the strand.
+	 */
+	void handle(const std::string& message);
+	/**
+	 * Announces this node and forgets banks not heard of in a while, then schedules itself again. Runs on the strand.
+	 */
+	void tick();
+
+	static std::shared_ptr<Discovery> _instance;
+
+public:
+	~Discovery();
+
+	/**
+	 * Joins the group and asks it for banks, unless disabled by config::DISCOVERY.
+	 * If the group can't be joined, discovery stays off and banks are looked for the old way.
+	 */
+	void start();
+	/**
+	 * Says goodbye to the group and stops listening.
+	 */
+	void stop();
+
+	/**
+	 * @return Whether the group was asked a while ago and another node announced itself, so peers() can be trusted to
+	 *         list the banks on the LAN. Until then, the network is scanned instead.
+	 */
+	bool ready();
+	/**
+	 * @return The address and port of every other bank discovered, followed by config::SEEDS.
+	 */
+	std::vector<std::pair<std::string, int>> peers();
+
+	static std::shared_ptr<Discovery> instance();
+};
+
+#endif
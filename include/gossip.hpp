@@ -0,0 +1,108 @@
+#ifndef GOSSIP_HPP
+#define GOSSIP_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "bank.hpp"
+#include "cancellation.hpp"
+
+/**
+ * The figures of every bank in the network, spread gossip style.
+ *
+ * Every config::GOSSIP_INTERVAL milliseconds (with some jitter), the node sends its digest (what it knows about every
+ * bank, itself included) to config::GOSSIP_FANOUT random peers with GS, and merges the digest they answer with.
+ * News thus reaches all N banks within O(log N) rounds, and network-wide queries are answered from memory.
+ *
+ * Peers are the banks heard of so far, plus the ones from Discovery to get going. Banks are told apart by address and port,
+ * so several nodes can share an address (e.g. on loopback). A bank that stops gossiping is forgotten after
+ * GOSSIP_EXPIRY_ROUNDS rounds without news from it.
+ */
+class Gossip
+{
+private:
+	struct Entry
+	{
+		Bank bank;
+		int port = 0;
+		/// Set by the bank itself every round, so news from it can be told from old rumours.
+		unsigned long long int heartbeat = 0;
+		std::chrono::steady_clock::time_point updated;
+	};
+
+	Gossip();
+
+	/// Other banks, by "address:port".
+	std::unordered_map<std::string, Entry> entries;
+	/// Heartbeats of forgotten banks, so peers that haven't forgotten them yet don't bring them back.
+	std::unordered_map<std::string, Entry> forgotten;
+	/// Discovered banks that don't gossip, and when to ask them again.
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> refused;
+	/// This bank's latest heartbeat, never going back even if the clock does.
+	unsigned long long int heartbeat = 0;
+	/// Whether any peer answered so far.
+	bool heard = false;
+
+	std::thread gossiper;
+	bool running = false;
+	CancellationToken gossiping;
+	std::mt19937 random;
+	std::mutex gossipLocker;
+	std::condition_variable gossipCondition;
+
+	/**
+	 * The gossiper's loop.
+	 */
+	void gossip();
+	friend void gossipThread(Gossip* gossip);
+	/**
+	 * Exchanges digests with the next few peers, all at once on the Reactor, over connections of their own.
+	 */
+	void round();
+	/**
+	 * Forgets banks not heard from in a while. Expects gossipLocker to be held.
+	 */
+	void expire();
+
+	static std::shared_ptr<Gossip> _instance;
+
+public:
+	~Gossip();
+
+	/**
+	 * Starts gossiping, if enabled by config::GOSSIP.
+	 */
+	void start();
+	/**
+	 * Stops gossiping, abandoning the round in progress.
+	 */
+	void stop();
+
+	/**
+	 * @return The GS line describing this bank and every bank it knows of.
+	 */
+	std::string digest();
+	/**
+	 * Takes in whatever is newer in a received GS line. Malformed entries are skipped.
+	 */
+	void merge(const std::vector<std::string>& arguments);
+
+	/**
+	 * @return Whether any peer was heard from, so banks() can be trusted to list the gossiping banks.
+	 */
+	bool ready();
+	/**
+	 * @return Every other bank heard of, as of its latest news.
+	 */
+	std::vector<Bank> banks();
+
+	static std::shared_ptr<Gossip> instance();
+};
+
+#endif
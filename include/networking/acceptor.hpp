@@ -30,28 +30,49 @@
 #ifndef NETWORKING_ACCEPTOR_HPP
 #define NETWORKING_ACCEPTOR_HPP
 
+#include <unordered_map>
 #include "networking/socket.hpp"
 
-class Acceptor
+/**
+ * Accepts incoming TCP connections on the shared Reactor.
+ */
+class Acceptor : public std::enable_shared_from_this<Acceptor>
 {
 private:
-	boost::asio::io_context ioContext;
 	int _port = 0;
 
-	bool accepting = false;
+	std::atomic<bool> accepting = false;
+	bool dispatchClients;
 
 	boost::asio::ip::tcp::acceptor acceptor;
-	std::vector<std::shared_ptr<Socket>> sockets;
+	std::unordered_map<Socket*, std::shared_ptr<Socket>> sockets;
+	std::unordered_map<std::string, int> connectionsPerAddress;
 	std::shared_ptr<Socket> acceptedSocket = nullptr;
 
-	std::vector<Packet> incomingPackets;
+	/// Shared by all accepted sockets, unless they are dispatched to a Client.
+	std::shared_ptr<RingQueue<Packet>> incomingPackets;
+	std::vector<std::weak_ptr<Socket>> stalledSockets;
+	std::atomic<size_t> stalledCount = 0;
 	std::mutex acceptorLocker;
 	std::mutex internalLocker;
+	std::mutex stalledLocker;
 
-	std::thread acceptorThread;
+	/**
+	 * Schedules the next asynchronous accept.
+	 */
+	void accept();
+	/**
+	 * Handles a completed accept, then schedules the next one.
+	 */
+	void accepted(const boost::system::error_code& error);
+
+	void listen(const boost::asio::ip::tcp::endpoint& endpoint);
 
 public:
-	Acceptor();
+	/**
+	 * @param dispatchClients Whether accepted sockets are handled by a Client, or their packets are accessible from next().
+	 */
+	Acceptor(bool dispatchClients = true);
 
 	~Acceptor();
 
@@ -60,9 +81,13 @@ public:
 	int port() const;
 
 	/**
-	 * Loads the incoming packets form all accepted connections into the queue accessible from next().
+	 * Called by an accepted socket when it had to stop receiving because the shared queue is full.
+	 */
+	void stalled(std::shared_ptr<Socket> socket);
+	/**
+	 * Called by an accepted socket when it closes.
 	 */
-	void update();
+	void closed(Socket* socket);
 
 	/**
 	 * @return The amount of pending received packets, waiting for processing.
@@ -73,11 +98,6 @@ public:
 	 */
 	Packet next();
 
-	/**
-	 * Call in a separate thread.
-	 */
-	void hostThread();
-
 	void hostV4(int port);
 	void hostV6(int port);
 	void host(const std::string& address, int port);
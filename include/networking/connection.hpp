@@ -55,12 +55,18 @@ public:
 	 * @return The next packet to be processed, which is REMOVED FROM THE QUEUE.
 	 */
 	Packet next();
+	/**
+	 * Blocks until a packet is pending, the connection closes or the token is cancelled.
+	 *
+	 * @return Whether a packet is pending.
+	 */
+	bool wait(const CancellationToken& token);
 
 	void hostV4(int port);
 	void hostV6(int port);
 	void host(const std::string& address, int port);
-	void connectV4(std::string ip, std::string port);
-	void connectV6(std::string ip, std::string port);
+	void connectV4(std::string ip, std::string port, const CancellationToken& token = CancellationToken());
+	void connectV6(std::string ip, std::string port, const CancellationToken& token = CancellationToken());
 
 	void send(Buffer buffer, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
 	void send(Buffer buffer);
@@ -38,6 +38,7 @@ class Packet
 private:
 	Buffer packetData;
 	std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
+	bool _shed = false;
 
 public:
 	Packet();
@@ -46,6 +47,12 @@ public:
 
 	Buffer data() const;
 	std::shared_ptr<boost::asio::ip::tcp::socket> socket() const;
+
+	/**
+	 * @return Whether this packet arrived while its connection had too many requests in flight, and must be rejected without handling.
+	 */
+	bool shed() const;
+	void shed(bool shed);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef NETWORKING_PEERLINK_HPP
+#define NETWORKING_PEERLINK_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "cancellation.hpp"
+#include "networking/socket.hpp"
+
+/**
+ * A connection to another bank that negotiated request IDs with XM.
+ *
+ * Every request is sent as "#id command" and answered with "#id response", so any amount of forwarded
+ * requests can share the connection, and they're answered in whatever order the peer finishes them.
+ */
+class PeerLink : public std::enable_shared_from_this<PeerLink>
+{
+private:
+	struct Call
+	{
+		bool done = false;
+		Packet response;
+	};
+
+	std::shared_ptr<Socket> socket;
+	/// Requests waiting for their response, by ID.
+	std::unordered_map<unsigned long long int, std::shared_ptr<Call>> calls;
+	unsigned long long int nextId = 1;
+	bool broken = false;
+	std::chrono::steady_clock::time_point lastUsed;
+	std::mutex linkLocker;
+	std::condition_variable linkCondition;
+
+	/**
+	 * Hands the received responses to the requests waiting for them. Called by the Socket.
+	 */
+	void received();
+
+public:
+	/**
+	 * @param socket A connection that just negotiated request IDs.
+	 */
+	PeerLink(std::shared_ptr<Socket> socket);
+	~PeerLink();
+
+	/**
+	 * Asks the peer for request IDs over an otherwise idle connection.
+	 *
+	 * @return Whether the peer agreed. Peers that don't know XM answer with an error, and the connection stays usable as is.
+	 */
+	static bool negotiate(std::shared_ptr<Socket> socket, const CancellationToken& token);
+
+	/**
+	 * Starts handing out responses. Call once, after construction.
+	 */
+	void start();
+	/**
+	 * Sends a single line to the peer and waits for its response.
+	 *
+	 * @param sent Set to whether the line was handed to the connection, so the peer may have received it.
+	 */
+	Packet request(const std::string& line, const CancellationToken& token, bool& sent);
+
+	bool isOpen();
+	/**
+	 * @return Whether no request is waiting and none was made since the given time.
+	 */
+	bool idleSince(std::chrono::steady_clock::time_point time);
+	/**
+	 * Closes the connection, failing every request still waiting.
+	 */
+	void close();
+};
+
+#endif
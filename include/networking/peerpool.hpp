@@ -0,0 +1,150 @@
+#ifndef NETWORKING_PEERPOOL_HPP
+#define NETWORKING_PEERPOOL_HPP
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "boost/asio.hpp"
+#include "cancellation.hpp"
+#include "networking/peerlink.hpp"
+#include "networking/socket.hpp"
+
+/**
+ * Long-lived connections to other banks, reused across forwarded requests.
+ *
+ * Peers that support request IDs get a single shared PeerLink, which carries any amount of requests at once.
+ * Other peers get exclusive connections, one request at a time each.
+ *
+ * Every idle connection keeps reading on the Reactor, so one the peer closes is noticed right away,
+ * and one that sends something unasked for is not reused. Idle connections are closed after config::PEER_IDLE_TIMEOUT.
+ *
+ * The round trip time of every peer is tracked as a moving average and variance (as TCP does), giving each peer its
+ * own timeout, no longer than config::TIMEOUT.
+ */
+class PeerPool
+{
+private:
+	struct Idle
+	{
+		std::shared_ptr<Socket> socket;
+		std::chrono::steady_clock::time_point since;
+	};
+	struct Latency
+	{
+		/// Smoothed round trip time and its mean deviation, in seconds.
+		double rtt = 0;
+		double variance = 0;
+		long long int samples = 0;
+		/// Requests in a row that timed out, each doubling the timeout.
+		int timeouts = 0;
+		/// The latest round trip times, for percentiles. Overwritten round and round once full.
+		std::vector<double> recent;
+	};
+
+	struct AsyncRequest;
+
+	PeerPool();
+
+	/// Idle connections by "address:port", the most recently used last.
+	std::unordered_map<std::string, std::vector<Idle>> idle;
+	std::unordered_map<std::string, std::shared_ptr<PeerLink>> links;
+	/// Peers that refused request IDs, and when to ask them again.
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> plainPeers;
+	std::mutex poolLocker;
+	/// Round trip times by "address:port".
+	std::unordered_map<std::string, Latency> latencies;
+	std::mutex latencyLocker;
+	boost::asio::steady_timer evictionTimer;
+	bool running = false;
+
+	/**
+	 * Takes a healthy idle connection to the peer, or connects a new one.
+	 *
+	 * @param reused Set to whether the connection came from the pool.
+	 */
+	std::shared_ptr<Socket> acquire(const std::string& address, int port, const CancellationToken& token, bool& reused);
+	/**
+	 * Returns a connection to the pool, or closes it if it's unhealthy or the peer has enough idle ones.
+	 */
+	void release(const std::string& address, int port, std::shared_ptr<Socket> socket);
+	/**
+	 * Gets the link to the peer, negotiating a new one if there's none yet.
+	 *
+	 * @param reused Set to whether the link existed already.
+	 * @return The link, or nullptr if the peer doesn't support request IDs (or config::PEER_MULTIPLEX is off).
+	 */
+	std::shared_ptr<PeerLink> link(const std::string& address, int port, const CancellationToken& token, bool& reused);
+	/**
+	 * Closes idle connections that timed out or were closed by the peer, then schedules itself again.
+	 */
+	void evict();
+	/**
+	 * Takes a round trip time of the peer into its average, variance and percentiles.
+	 */
+	void measured(const std::string& address, int port, double rtt);
+	/**
+	 * Counts a request to the peer that ran out of time, doubling its timeout until it answers again.
+	 */
+	void timedOut(const std::string& address, int port);
+	/**
+	 * request() without measuring the round trip time.
+	 */
+	Packet exchange(const std::string& address, int port, const std::string& line, const CancellationToken& token, bool exclusive);
+
+	static std::shared_ptr<PeerPool> _instance;
+
+public:
+	~PeerPool();
+
+	/**
+	 * Sends a single line to the peer and waits for the single line answering it.
+	 * A pooled connection or link that turns out to be dead before answering is replaced by a new one, once, if the
+	 * request didn't leave yet or is readOnly().
+	 *
+	 * @param exclusive Whether to avoid the link, sending the request over a connection of its own.
+	 * @return The answer.
+	 */
+	Packet request(const std::string& address, int port, const std::string& line, const CancellationToken& token, bool exclusive = false);
+	/**
+	 * Sends a single line to the peer over a connection of its own and reads the answer, all on the Reactor, without
+	 * holding any thread meanwhile. Cancelling the token closes the connection right away.
+	 * The round trip time is measured as by request(), from sending the line on.
+	 *
+	 * @param done Called on the Reactor with the answer, or with what went wrong (boost::system::system_error if the
+	 *             peer couldn't be connected to). Must not block.
+	 */
+	void requestAsync(const std::string& address, int port, const std::string& line, const CancellationToken& token, std::function<void(std::exception_ptr failure, const Packet& answer)> done);
+	/**
+	 * @return How long to wait for the peer's answer: its round trip time plus four deviations, doubled for every
+	 *         timeout since the last answer, but no longer than config::TIMEOUT (nor shorter than 200 ms).
+	 *         config::TIMEOUT if the peer never answered yet.
+	 */
+	std::chrono::milliseconds timeout(const std::string& address, int port);
+	/**
+	 * @return The round trip time the peer answers within, percentile out of 100 times.
+	 *         0 if it didn't answer often enough to tell.
+	 */
+	std::chrono::microseconds percentile(const std::string& address, int port, int percentile);
+	/**
+	 * @return Whether the command on the line doesn't change anything, so sending it twice is harmless.
+	 */
+	static bool readOnly(const std::string& line);
+	/**
+	 * @return The round trip time of every peer, one "peer_rtt[address:port]: ..." per line.
+	 */
+	std::string latencyReport();
+
+	/**
+	 * Closes all idle connections and links, and stops evicting.
+	 */
+	void stop();
+
+	static std::shared_ptr<PeerPool> instance();
+};
+
+#endif
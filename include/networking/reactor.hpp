@@ -0,0 +1,41 @@
+#ifndef NETWORKING_REACTOR_HPP
+#define NETWORKING_REACTOR_HPP
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include "boost/asio.hpp"
+
+/**
+ * The event loop shared by every Socket and Acceptor.
+ *
+ * A fixed amount of threads drives a single io_context, so the thread count
+ * stays the same no matter how many connections are open.
+ */
+class Reactor
+{
+private:
+	Reactor();
+
+	boost::asio::io_context ioContext;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+	std::vector<std::thread> ioThreads;
+
+	bool running = false;
+
+	static std::shared_ptr<Reactor> _instance;
+
+public:
+	~Reactor();
+
+	boost::asio::io_context& context();
+
+	/**
+	 * Stops the event loop and waits for all of its threads to finish.
+	 */
+	void stop();
+
+	static std::shared_ptr<Reactor> instance();
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef NETWORKING_RINGQUEUE_HPP
+#define NETWORKING_RINGQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * A bounded, lock-free queue (Dmitry Vyukov's array based design).
+ *
+ * Any amount of threads may push and pop at the same time, so it serves both
+ * as a single producer/single consumer queue for one Socket and as a multi
+ * producer queue shared by all sockets of an Acceptor.
+ */
+template<typename T>
+class RingQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+
+public:
+	/**
+	 * @param capacity Maximum amount of queued elements. Rounded up to a power of two.
+	 */
+	RingQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		cells.reset(new Cell[size]);
+		mask = size - 1;
+		for (size_t index = 0; index < size; ++index)
+		{
+			cells[index].sequence.store(index, std::memory_order_relaxed);
+		}
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	RingQueue(const RingQueue& other) = delete;
+
+	/**
+	 * @return false if the queue is full, in which case value is left untouched.
+	 */
+	bool push(T&& value)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells[position & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+			if (difference == 0)
+			{
+				if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(value);
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+	bool push(const T& value)
+	{
+		T copy = value;
+		return push(std::move(copy));
+	}
+
+	/**
+	 * @return false if the queue is empty.
+	 */
+	bool pop(T& value)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells[position & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+			if (difference == 0)
+			{
+				if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+		value = std::move(cell->data);
+		cell->data = T();
+		cell->sequence.store(position + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Pops up to max elements, appending them to out.
+	 *
+	 * @return The amount of popped elements.
+	 */
+	size_t popBatch(std::vector<T>& out, size_t max)
+	{
+		size_t count = 0;
+		T value;
+		while (count < max && pop(value))
+		{
+			out.emplace_back(std::move(value));
+			++count;
+		}
+		return count;
+	}
+
+	/**
+	 * @return The amount of queued elements, counting those a producer is still writing. Only a snapshot while other
+	 *         threads push or pop.
+	 */
+	size_t size() const
+	{
+		size_t tailPosition = tail.load(std::memory_order_acquire);
+		size_t headPosition = head.load(std::memory_order_acquire);
+		return headPosition > tailPosition ? headPosition - tailPosition : 0;
+	}
+	/**
+	 * @return Whether pop() would fail, i.e. the next element isn't published yet, even if a producer claimed its cell.
+	 */
+	bool empty() const
+	{
+		size_t position = tail.load(std::memory_order_acquire);
+		size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+		return (intptr_t)sequence - (intptr_t)(position + 1) < 0;
+	}
+	size_t capacity() const
+	{
+		return mask + 1;
+	}
+};
+
+#endif
@@ -30,31 +30,91 @@
 #ifndef NETWORKING_SOCKET_HPP
 #define NETWORKING_SOCKET_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include "boost/asio.hpp"
+#include "cancellation.hpp"
 #include "networking/packet.hpp"
+#include "networking/ringqueue.hpp"
 #include "client.hpp"
 
+class Acceptor;
+
 /**
  * An individual TCP socket. Used by Connection.
+ *
+ * All sockets run on the shared Reactor; reading is done with asynchronous
+ * operations, so an open socket doesn't occupy a thread of its own.
  */
 class Socket : public std::enable_shared_from_this<Socket>
 {
 private:
-	boost::asio::io_context ioContext;
-
 	std::shared_ptr<boost::asio::ip::tcp::socket> socket;
-	std::unique_ptr<Client> client;
-
-	std::vector<Packet> incomingPackets;
+	std::shared_ptr<Client> client;
+	std::function<void()> listener;
+	std::string _address;
+
+	/// Bytes of an incomplete line, kept across reads.
+	Buffer receiveBuffer;
+	char receiveChunk[16384];
+	/// Received packets that didn't fit into the queue yet. Only touched by the receiving side.
+	std::vector<Packet> overflow;
+
+	std::shared_ptr<RingQueue<Packet>> incomingPackets;
+	std::weak_ptr<Acceptor> owner;
 	std::mutex incomingLocker;
+	std::condition_variable incomingCondition;
+	std::atomic<int> waiting = 0;
 	std::mutex internalLocker;
 
-	std::thread receiveThread;
-	std::thread handlerThread;
+	/// Responses waiting to be written. The front one may be partially written already.
+	std::deque<Buffer> outgoing;
+	size_t outgoingOffset = 0;
+	size_t outgoingBytes = 0;
+	bool writing = false;
+	std::mutex outgoingLocker;
+
+	std::atomic<bool> receiving = false;
+	std::atomic<bool> paused = false;
+	/// Set by reject(); the socket closes once everything queued has been written.
+	std::atomic<bool> lingering = false;
+
+	/// Requests received but not yet answered by the Client.
+	std::atomic<size_t> inflight = 0;
+	bool dispatched = false;
+
+	/**
+	 * Handles a completed read, then schedules the next one.
+	 */
+	void received(const boost::system::error_code& error, size_t size);
+	/**
+	 * Queues the overflow, then either schedules the next read or pauses receiving if the queue is full.
+	 */
+	void proceed();
+	/**
+	 * Wakes up whoever is waiting for packets.
+	 */
+	void signal();
+
+	/**
+	 * Writes as much of the outgoing queue as possible with one gathered write.
+	 */
+	void write();
+	/**
+	 * Handles a completed (possibly partial) write, then continues with whatever is left.
+	 */
+	void written(const boost::system::error_code& error, size_t size);
 
-	bool receiving = false;
+	/**
+	 * Connects asynchronously and blocks until connected. Cancelling the token closes the socket, aborting the connect.
+	 */
+	void connect(const boost::asio::ip::tcp::resolver::results_type& endpoints, const CancellationToken& token);
 
 public:
+	Socket();
+
 	~Socket();
 
 	void close();
@@ -62,16 +122,41 @@ public:
 	std::shared_ptr<boost::asio::ip::tcp::socket> raw() const;
 
 	/**
-	 * Starts the receiving loop. This should be called from a separate thread.
+	 * Schedules the next asynchronous read. Every complete line it yields is queued as a packet.
 	 */
 	void receive();
 
 	/**
-	 * Starts the receiving thread.
+	 * Starts receiving. If dispatchClient is set, incoming packets are handled by a Client.
 	 */
 	void start(bool dispatchClient = false);
+	/**
+	 * Starts receiving into a queue shared with the other sockets of an Acceptor.
+	 */
+	void start(std::shared_ptr<RingQueue<Packet>> queue);
+	/**
+	 * Calls listener whenever packets arrive, and once more when the socket closes. Call before start().
+	 * The listener runs on the Reactor, so it mustn't block.
+	 */
+	void listen(std::function<void()> listener);
+	/**
+	 * Sends a final message without reading anything, then closes.
+	 */
+	void reject(Buffer message);
+	/**
+	 * Sets the Acceptor that is told when this socket stalls or closes.
+	 */
+	void own(std::weak_ptr<Acceptor> owner);
+	/**
+	 * Continues receiving after the packet queue filled up. Called once packets were taken out of the queue.
+	 */
+	void resume();
 
 	bool isOpen() const;
+	/**
+	 * @return The remote IP address, as of when the socket started.
+	 */
+	std::string address() const;
 
 	/**
 	 * @return The amount of pending received packets, waiting for processing.
@@ -81,12 +166,35 @@ public:
 	 * @return The next packet to be processed, which is REMOVED FROM THE QUEUE.
 	 */
 	Packet next();
+	/**
+	 * Moves up to max pending packets into packets, REMOVING THEM FROM THE QUEUE.
+	 *
+	 * @return The amount of moved packets.
+	 */
+	size_t next(std::vector<Packet>& packets, size_t max);
+	/**
+	 * Called by the Client once it answered a request, making room for another one under config::MAX_INFLIGHT.
+	 */
+	void handled();
+	/**
+	 * Blocks until a packet is pending, the socket closes or the token is cancelled.
+	 *
+	 * @return Whether a packet is pending.
+	 */
+	bool wait(const CancellationToken& token);
 
-	void accept(boost::asio::ip::tcp::acceptor& acceptor);
-	void connectV4(std::string ip, std::string port);
-	void connectV6(std::string ip, std::string port);
+	void connectV4(std::string ip, std::string port, const CancellationToken& token = CancellationToken());
+	void connectV6(std::string ip, std::string port, const CancellationToken& token = CancellationToken());
 
+	/**
+	 * Queues a buffer for sending and returns without waiting for the write.
+	 */
 	void send(Buffer buffer);
+	/**
+	 * @return Whether at least config::SEND_HIGH_WATER bytes are waiting to be written.
+	 * The Client doesn't start new requests until the peer catches up; it's notified once it does.
+	 */
+	bool congested();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef PLANNER_HPP
+#define PLANNER_HPP
+
+#include <vector>
+#include "bank.hpp"
+
+/**
+ * A set of banks to rob.
+ */
+struct RobberyPlan
+{
+	std::vector<Bank> banks;
+	long long int total = 0;
+	long long int clients = 0;
+};
+
+/**
+ * Picks the banks to rob for at least a target amount, affecting as few clients as possible.
+ *
+ * Solved as a covering knapsack over amounts, by dynamic programming. Amounts are rounded down to buckets, so that
+ * banks times buckets stays around MAX_PLANNER_CELLS, which keeps planning in the milliseconds for thousands of banks.
+ * Rounding down never yields a plan short of the target; with coarse buckets it may miss the optimum, so the result
+ * is never worse than the greedy plan, which is computed too.
+ */
+class Planner
+{
+public:
+	/// Upper bound on banks times buckets.
+	static constexpr long long int MAX_PLANNER_CELLS = 1000000;
+	/// Upper bound on buckets, for few banks. Finer ones hardly ever make a better plan.
+	static constexpr long long int MAX_PLANNER_BUCKETS = 1 << 16;
+
+	/**
+	 * @throws InterbanqaException if all the banks together don't have the target amount.
+	 */
+	static RobberyPlan plan(const std::vector<Bank>& banks, long long int target);
+	/**
+	 * The plan RP used to make: the banks with the most money per client first, until the target is reached.
+	 * Banks that turn out not to be needed are then left out.
+	 */
+	static RobberyPlan greedy(const std::vector<Bank>& banks, long long int target);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PORTDIRECTORY_HPP
+#define PORTDIRECTORY_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "boost/asio.hpp"
+
+/**
+ * Remembers which port each known bank listens on, so forwarding a request costs one connect instead of trying every port.
+ *
+ * Entries expire after config::PORT_CACHE_TTL seconds and are forgotten as soon as connecting to them fails.
+ * If config::PORT_CACHE_PATH is set, the directory is kept on disk across restarts. Changes are written a few seconds
+ * after they're made, on the WorkerPool, so learning a port on a Reactor thread never waits for the disk.
+ */
+class PortDirectory
+{
+private:
+	struct Entry
+	{
+		int port;
+		/// System time, so it stays meaningful after a restart.
+		std::chrono::system_clock::time_point expires;
+	};
+
+	PortDirectory();
+
+	std::unordered_map<std::string, Entry> entries;
+	std::mutex directoryLocker;
+	/// Whether there are changes not yet written to disk.
+	bool dirty = false;
+	/// Held while writing the file, so concurrent saves don't interleave.
+	std::mutex saveLocker;
+	/// Fires when the changes are due to be saved. Armed while flushScheduled is set, guarded by directoryLocker.
+	boost::asio::steady_timer flushTimer;
+	bool flushScheduled = false;
+
+	/**
+	 * Loads the entries saved at config::PORT_CACHE_PATH. Expired ones are skipped.
+	 */
+	void load();
+	/**
+	 * Has the changes saved soon, unless that's already arranged. Expects directoryLocker to be held.
+	 */
+	void scheduleFlush();
+	/**
+	 * Hands the save over to the WorkerPool, or tries again later if it's busy.
+	 */
+	void flush();
+
+	static std::shared_ptr<PortDirectory> _instance;
+
+public:
+	/**
+	 * @return The port the bank at address was last seen on, or 0 if it isn't known (or expired).
+	 */
+	int find(const std::string& address);
+	/**
+	 * Records that the bank at address answered on port, renewing its TTL.
+	 */
+	void learn(const std::string& address, int port);
+	/**
+	 * Forgets the port of the bank at address, unless it was meanwhile learned to be a different one.
+	 */
+	void forget(const std::string& address, int port);
+
+	/**
+	 * Writes the directory to config::PORT_CACHE_PATH, if it changed since the last save.
+	 * Called a while after a port is learned or forgotten, and by the Server on shutdown.
+	 */
+	void save();
+
+	static std::shared_ptr<PortDirectory> instance();
+};
+
+#endif
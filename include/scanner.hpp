@@ -0,0 +1,118 @@
+#ifndef SCANNER_HPP
+#define SCANNER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "bank.hpp"
+#include "cancellation.hpp"
+
+/**
+ * Looks for banks on a range of addresses, asking every port between config::MIN_PORT and config::MAX_PORT for BS
+ * (or BA and BN, if the bank doesn't know BS).
+ *
+ * Probes run asynchronously on the Reactor, at most config::SCAN_CONCURRENCY at once (unless throttled), each for at most
+ * config::SCAN_PROBE_TIMEOUT milliseconds. Targets are generated as they're needed, so sweeping a large network
+ * takes no more memory than a small one.
+ */
+class Scanner : public std::enable_shared_from_this<Scanner>
+{
+private:
+	struct Probe;
+
+	/// Addresses to scan, either explicitly listed (with their port, or 0 for every port) or the range [nextAddress, lastAddress).
+	std::vector<std::pair<std::string, int>> listed;
+	uint32_t nextAddress = 0;
+	uint32_t lastAddress = 0;
+	size_t nextIndex = 0;
+	int nextPort = 0;
+
+	CancellationToken token;
+	std::unordered_set<std::shared_ptr<Probe>> active;
+	/// Banks found so far, by address.
+	std::unordered_map<std::string, Bank> found;
+	/// The ports each address answered on, or merely accepted connections on when connectOnly.
+	std::unordered_map<std::string, std::vector<int>> openPorts;
+	/// Whether probes only connect, without asking for anything, to find where something listens at all.
+	bool connectOnly = false;
+	/// Probes running at once at most.
+	int concurrency = 0;
+	/// Addresses where a probe ran out of time, so something may be listening there, just slowly.
+	std::unordered_set<std::string> expired;
+	bool stopped = false;
+	/// Whether every target was probed, rather than the scan being cut short.
+	bool exhausted = false;
+	std::mutex scanLocker;
+	std::condition_variable scanCondition;
+
+	Scanner();
+
+	/**
+	 * Picks the next address and port to probe, skipping addresses where a bank was found already.
+	 *
+	 * @return false if there are none left.
+	 */
+	bool nextTarget(std::string& address, int& port);
+	/**
+	 * Starts probes until the concurrency window is full or there's nothing left. Expects scanLocker to be held.
+	 */
+	void launch();
+	/**
+	 * Records the result of a probe, then launches more.
+	 */
+	void finished(std::shared_ptr<Probe> probe, bool answered, const Bank& bank);
+
+public:
+	/**
+	 * Scans every host address of the network.
+	 */
+	static std::shared_ptr<Scanner> network(const std::string& address, int prefixLength);
+	/**
+	 * Scans the given addresses only.
+	 */
+	static std::shared_ptr<Scanner> targets(const std::vector<std::string>& addresses);
+	/**
+	 * Scans the given addresses, each on the given port only (or every port, if it's 0).
+	 */
+	static std::shared_ptr<Scanner> endpoints(const std::vector<std::pair<std::string, int>>& endpoints);
+	/**
+	 * Connects to every port of the address, without asking anything, to find the ports something listens on.
+	 * run() finds no banks then, see ports().
+	 */
+	static std::shared_ptr<Scanner> listeners(const std::string& address);
+
+	/**
+	 * Runs at most concurrency probes at once, rather than config::SCAN_CONCURRENCY. Call before run().
+	 */
+	void throttle(int concurrency);
+
+	/**
+	 * Blocks until every target was probed or the token is cancelled, whichever comes first.
+	 * Probes still running then are abandoned.
+	 *
+	 * @return The banks found, possibly only some of them.
+	 */
+	std::vector<Bank> run(const CancellationToken& token);
+	/**
+	 * @return Whether the last run() probed every target, so a bank it didn't find isn't there.
+	 */
+	bool completed();
+	/**
+	 * @return The ports the address answered on (for listeners(), accepted a connection on), in the order they did.
+	 */
+	std::vector<int> ports(const std::string& address);
+	/**
+	 * @return Whether a probe of the address ran out of time, rather than being refused or answered by something
+	 *         that isn't a bank. A bank may still be there, too slow to answer (or, for listeners(), to accept).
+	 */
+	bool timedOut(const std::string& address);
+};
+
+#endif
@@ -1,16 +1,28 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include <condition_variable>
+#include <mutex>
 #include "networking/connection.hpp"
 
 class Server
 {
 private:
 	Connection connection;
+	boost::asio::signal_set signals;
+
 public:
+	Server();
 	~Server();
 
+	/**
+	 * Hosts the node and blocks until stop() is called, "exit" is typed on the console or SIGINT/SIGTERM is received.
+	 */
 	void start();
+	/**
+	 * Makes start() return. Safe to call from any thread.
+	 */
+	void stop();
 };
 
-#endif
\ No newline at end of file
+#endif
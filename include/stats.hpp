@@ -0,0 +1,86 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <string>
+
+namespace stats
+{
+	extern std::atomic<long long int> CONNECTIONS_OPEN;
+	extern std::atomic<long long int> CONNECTIONS_ACCEPTED;
+	/// Connections rejected because of max_connections or max_connections_per_ip.
+	extern std::atomic<long long int> CONNECTIONS_SHED;
+	extern std::atomic<long long int> REQUESTS_HANDLED;
+	/// Requests rejected because of max_inflight.
+	extern std::atomic<long long int> REQUESTS_SHED;
+	extern std::atomic<long long int> REQUESTS_TIMED_OUT;
+
+	extern std::atomic<long long int> WORKER_QUEUE_DEPTH;
+	extern std::atomic<long long int> WORKER_QUEUE_PEAK;
+	extern std::atomic<long long int> WORKER_TASKS;
+	/// Total time tasks spent in the run queue before a worker picked them up.
+	extern std::atomic<long long int> WORKER_WAIT_TOTAL_US;
+	extern std::atomic<long long int> WORKER_WAIT_MAX_US;
+
+	/// Forwards that found the bank's port in the PortDirectory.
+	extern std::atomic<long long int> PORT_CACHE_HITS;
+	extern std::atomic<long long int> PORT_CACHE_MISSES;
+	/// Known ports forgotten because connecting to them failed.
+	extern std::atomic<long long int> PORT_CACHE_INVALIDATIONS;
+
+	/// New connections opened to peer banks.
+	extern std::atomic<long long int> PEER_CONNECTS;
+	/// Forwarded requests sent over an idle pooled connection.
+	extern std::atomic<long long int> PEER_REUSES;
+	/// Idle connections closed because they timed out or went bad.
+	extern std::atomic<long long int> PEER_EVICTIONS;
+	/// Links to peer banks that agreed to request IDs.
+	extern std::atomic<long long int> PEER_LINKS;
+	/// Forwarded requests sent over a link, sharing it with others.
+	extern std::atomic<long long int> PEER_MULTIPLEXED;
+
+	/// Ports probed while looking for banks in the network.
+	extern std::atomic<long long int> SCAN_PROBES;
+	extern std::atomic<long long int> SCAN_BANKS_FOUND;
+
+	/// Banks currently in the BankDirectory.
+	extern std::atomic<long long int> DIRECTORY_BANKS;
+	extern std::atomic<long long int> CRAWL_ROUNDS;
+
+	/// Other banks currently known from gossip.
+	extern std::atomic<long long int> GOSSIP_BANKS;
+	extern std::atomic<long long int> GOSSIP_ROUNDS;
+	/// Digests exchanged with peers that answered.
+	extern std::atomic<long long int> GOSSIP_EXCHANGES;
+	extern std::atomic<long long int> GOSSIP_FAILURES;
+
+	/// Other banks currently known from discovery.
+	extern std::atomic<long long int> DISCOVERY_BANKS;
+	/// Announcements received from other banks.
+	extern std::atomic<long long int> DISCOVERY_ANNOUNCEMENTS;
+
+	/// Addresses currently refused by the circuit breaker.
+	extern std::atomic<long long int> BREAKER_OPEN;
+	/// Forwarded requests refused right away because the address's circuit was open.
+	extern std::atomic<long long int> BREAKER_REJECTIONS;
+	/// Background probes of open circuits.
+	extern std::atomic<long long int> BREAKER_PROBES;
+
+	/// Read-only forwarded requests sent once more because the first attempt was slow.
+	extern std::atomic<long long int> HEDGES_FIRED;
+	/// Hedges that answered before the first attempt did.
+	extern std::atomic<long long int> HEDGES_WON;
+
+	/// Database transactions committed, and changes in them.
+	extern std::atomic<long long int> DB_COMMITS;
+	extern std::atomic<long long int> DB_CHANGES;
+	/// Batches of changes that couldn't be committed, and were lost.
+	extern std::atomic<long long int> DB_COMMIT_FAILURES;
+}
+
+/**
+ * @return All counters, one "name: value" per line.
+ */
+std::string statsReport();
+
+#endif
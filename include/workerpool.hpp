@@ -0,0 +1,59 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed amount of threads executing client commands from a bounded run queue.
+ */
+class WorkerPool
+{
+private:
+	struct Task
+	{
+		std::function<void()> work;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	WorkerPool();
+
+	std::deque<Task> tasks;
+	std::mutex tasksLocker;
+	std::condition_variable tasksCondition;
+	std::vector<std::thread> workers;
+	bool running = false;
+
+	/**
+	 * The loop of every worker thread.
+	 */
+	void work();
+	friend void workerThread(WorkerPool* pool);
+
+	static std::shared_ptr<WorkerPool> _instance;
+
+public:
+	~WorkerPool();
+
+	/**
+	 * Queues a task for execution.
+	 *
+	 * @return false if the run queue is full (config::WORKER_QUEUE), in which case the task is dropped.
+	 */
+	bool submit(std::function<void()> task);
+
+	/**
+	 * Drops all queued tasks and waits for the running ones to finish.
+	 */
+	void stop();
+
+	static std::shared_ptr<WorkerPool> instance();
+};
+
+#endif
@@ -1,13 +1,13 @@
 #include "bank.hpp"
-#include <algorithm>
 #include <chrono>
-#include <cmath>
-#include <cstdint>
-#include <future>
+#include <unordered_map>
+#include <vector>
+#include "bankdirectory.hpp"
 #include "config.hpp"
-#include "exception.hpp"
-#include "stringops.hpp"
-#include "networking/connection.hpp"
+#include "discovery.hpp"
+#include "gossip.hpp"
+#include "scanner.hpp"
+#include "database/account.hpp"
 
 double Bank::balancePerClient() const
 {
@@ -23,57 +23,59 @@ bool Bank::operator<(const Bank& other) const
 	return balancePerClient() < other.balancePerClient();
 }
 
-Bank fetchBank(std::string address)
+std::multiset<Bank> Bank::listBanks(const CancellationToken& token)
 {
-	Bank res;
-	res.address = address;
-	std::vector<std::string> response = parseCommand(Client::forwardRequest(parseCommand("BA"), address));
-	if (response.size() <= 1) throw InterbanqaException("Invalid response");
-	if (response[0] == "ER") throw InterbanqaException("Remote returned error");
-	res.balance = std::stoll(response[1]);
-
-	response = parseCommand(Client::forwardRequest(parseCommand("BN"), address));
-	if (response.size() <= 1) throw InterbanqaException("Invalid response");
-	if (response[0] == "ER") throw InterbanqaException("Remote returned error");
-	res.clients = std::stoi(response[1]);
-	return res;
-}
-
-std::multiset<Bank> Bank::listBanks()
-{
-	boost::asio::ip::address_v4 addr = boost::asio::ip::make_address_v4(config::ADDRESS);
-	boost::asio::ip::network_v4 network = boost::asio::ip::network_v4(addr, config::PREFIX_LENGTH);
-
-	boost::asio::ip::address_v4 first_address = network.address();
-	boost::asio::ip::address_v4 last_address = network.broadcast();
-
-	uint32_t first = first_address.to_uint();
-	uint32_t last = last_address.to_uint();
-
-	std::vector<std::future<Bank>> requests;
-	requests.reserve(last - first);
-
-	for (uint32_t ip = first; ip < last; ++ip)
+	std::shared_ptr<BankDirectory> directory = BankDirectory::instance();
+	std::shared_ptr<Gossip> gossip = Gossip::instance();
+	std::unordered_map<std::string, Bank> known;
+	if (directory->ready())
 	{
-		boost::asio::ip::address_v4 current_ip(ip);
-		requests.emplace_back(std::async(std::launch::async, fetchBank, current_ip.to_string()));
+		for (auto& bank : directory->banks())
+		{
+			known[bank.address] = bank;
+		}
 	}
-
-	std::multiset<Bank> res;
-	const std::chrono::time_point start = std::chrono::system_clock::now();
-	const std::chrono::time_point end = start + std::chrono::milliseconds((int)(150 * config::TIMEOUT));
-	for (auto& r : requests)
+	else
 	{
-		try
+		// Stops a little early, leaving the request time to answer with whatever was found
+		CancellationToken sweep(token, std::chrono::steady_clock::now() + std::chrono::milliseconds((int)(900 * config::TIMEOUT)));
+		std::shared_ptr<Discovery> discovery = Discovery::instance();
+		std::shared_ptr<Scanner> scanner;
+		if (discovery->ready())
 		{
-			auto status = r.wait_until(end);
-			if (status == std::future_status::timeout) throw InterbanqaException("Timeout");
-			else res.emplace(r.get());
+			scanner = Scanner::endpoints(discovery->peers());
 		}
-		catch (const std::exception& e)
+		else
 		{
-			// TODO: Log
+			scanner = Scanner::network(config::ADDRESS, config::PREFIX_LENGTH);
+		}
+		for (auto& bank : scanner->run(sweep))
+		{
+			known[bank.address] = bank;
+		}
+	}
+	// Gossip only knows banks that gossip, but it's usually the fresher of the two for those
+	if (gossip->ready())
+	{
+		for (auto& bank : gossip->banks())
+		{
+			auto it = known.find(bank.address);
+			if (it == known.end() || bank.version >= it->second.version) known[bank.address] = bank;
 		}
 	}
+
+	// This bank's own figures are always at hand, no need for stale ones
+	BankStatistics statistics = Account::statistics();
+	Bank& self = known[config::ADDRESS];
+	self.address = config::ADDRESS;
+	self.balance = statistics.funds;
+	self.clients = statistics.clients;
+	self.version = statistics.version;
+
+	std::multiset<Bank> res;
+	for (auto& bank : known)
+	{
+		res.emplace(bank.second);
+	}
 	return res;
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+#include "bankdirectory.hpp"
+#include <algorithm>
+#include "config.hpp"
+#include "discovery.hpp"
+#include "log.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "boost/asio.hpp"
+
+/// Intervals between rounds vary by up to this fraction, so nodes started together don't crawl in lockstep.
+const double CRAWL_JITTER = 0.2;
+
+void crawlerThread(BankDirectory* directory)
+{
+	directory->crawl();
+}
+
+BankDirectory::BankDirectory() : random(std::random_device()())
+{
+	boost::asio::ip::address_v4 addr = boost::asio::ip::make_address_v4(config::ADDRESS);
+	boost::asio::ip::network_v4 network = boost::asio::ip::network_v4(addr, config::PREFIX_LENGTH);
+	firstAddress = network.address().to_uint();
+	lastAddress = network.broadcast().to_uint();
+	cursor = firstAddress;
+}
+
+BankDirectory::~BankDirectory()
+{
+	stop();
+}
+
+void BankDirectory::start()
+{
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	if (running || !config::CRAWL)
+	{
+		return;
+	}
+	running = true;
+	crawling = CancellationToken();
+	crawler = std::thread(crawlerThread, this);
+}
+
+void BankDirectory::stop()
+{
+	directoryLocker.lock();
+	running = false;
+	directoryLocker.unlock();
+	crawling.cancel();
+	directoryCondition.notify_all();
+	if (crawler.joinable())
+	{
+		crawler.join();
+	}
+}
+
+void BankDirectory::crawl()
+{
+	std::uniform_real_distribution<double> jitter(1 - CRAWL_JITTER, 1 + CRAWL_JITTER);
+	{
+		// Nodes started together don't seed at the same moment either
+		std::unique_lock<std::mutex> lock(directoryLocker);
+		std::uniform_int_distribution<int> delay(0, config::CRAWL_INTERVAL);
+		directoryCondition.wait_for(lock, std::chrono::milliseconds(delay(random)), [this]()
+		{
+			return !running;
+		});
+		if (!running)
+		{
+			return;
+		}
+	}
+	try
+	{
+		seed();
+	}
+	catch (const std::exception& e)
+	{
+		runtime_log.log((std::string)"Seeding the bank directory failed: " + e.what(), LOG_WARNING);
+	}
+	while (true)
+	{
+		try
+		{
+			round();
+		}
+		catch (const std::exception& e)
+		{
+			runtime_log.log((std::string)"Crawler round failed: " + e.what(), LOG_WARNING);
+		}
+
+		std::unique_lock<std::mutex> lock(directoryLocker);
+		auto pause = std::chrono::milliseconds((long long int)(config::CRAWL_INTERVAL * jitter(random)));
+		directoryCondition.wait_for(lock, pause, [this]()
+		{
+			return !running;
+		});
+		if (!running)
+		{
+			return;
+		}
+	}
+}
+
+void BankDirectory::seed()
+{
+	auto start = std::chrono::steady_clock::now();
+	// As gentle on the network as the rounds, and given up on once the first entries would be due for a refresh,
+	// leaving whatever is left to the rounds
+	CancellationToken token(crawling, start + std::chrono::seconds(config::CRAWL_REFRESH));
+	std::shared_ptr<Scanner> scanner = Scanner::network(config::ADDRESS, config::PREFIX_LENGTH);
+	scanner->throttle(config::CRAWL_BATCH);
+	std::vector<Bank> found = scanner->run(token);
+	if (crawling.cancelled())
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	for (auto& bank : found)
+	{
+		entries[bank.address] = { bank, now };
+	}
+	complete = complete || scanner->completed();
+	stats::DIRECTORY_BANKS = entries.size();
+	runtime_log.log("Seeded the bank directory with " + std::to_string(found.size()) + " banks in " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count()) + " ms" + (complete ? "" : ", leaving the rest of the network to the crawler"), LOG_INFO);
+}
+
+void BankDirectory::round()
+{
+	std::vector<std::pair<std::string, int>> targets;
+	std::vector<std::string> refreshing;
+	std::shared_ptr<Discovery> discovery = Discovery::instance();
+	bool discovered = discovery->ready();
+	std::vector<std::pair<std::string, int>> peers;
+	std::unordered_map<std::string, int> ports;
+	if (discovered)
+	{
+		peers = discovery->peers();
+		for (auto& peer : peers)
+		{
+			ports.emplace(peer.first, peer.second);
+		}
+	}
+	directoryLocker.lock();
+	auto stale = std::chrono::steady_clock::now() - std::chrono::seconds(config::CRAWL_REFRESH);
+	for (auto& entry : entries)
+	{
+		if (targets.size() >= (size_t)config::CRAWL_BATCH) break;
+		if (entry.second.refreshed <= stale)
+		{
+			// Only the discovered port, if there is one
+			auto port = ports.find(entry.first);
+			targets.emplace_back(entry.first, port == ports.end() ? 0 : port->second);
+			refreshing.emplace_back(entry.first);
+		}
+	}
+	bool wrapped = false;
+	if (discovered)
+	{
+		// Discovered banks are all there is, no need to look through the network
+		wrapped = true;
+		for (auto& peer : peers)
+		{
+			if (entries.count(peer.first)) continue;
+			if (targets.size() >= (size_t)config::CRAWL_BATCH)
+			{
+				wrapped = false;
+				break;
+			}
+			targets.emplace_back(peer);
+		}
+	}
+	else
+	{
+		// Fills the rest of the batch with addresses not looked at in a while
+		size_t remaining = lastAddress - firstAddress;
+		while (targets.size() < (size_t)config::CRAWL_BATCH && remaining > 0)
+		{
+			std::string address = boost::asio::ip::address_v4(cursor).to_string();
+			if (++cursor >= lastAddress)
+			{
+				cursor = firstAddress;
+				wrapped = true;
+			}
+			--remaining;
+			if (!entries.count(address))
+			{
+				targets.emplace_back(address, 0);
+			}
+		}
+	}
+	CancellationToken token(crawling, std::chrono::steady_clock::now() + std::chrono::milliseconds((int)(1000 * config::TIMEOUT)));
+	directoryLocker.unlock();
+
+	if (targets.empty())
+	{
+		return;
+	}
+	std::shared_ptr<Scanner> scanner = Scanner::endpoints(targets);
+	std::vector<Bank> found = scanner->run(token);
+	if (crawling.cancelled())
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	if (scanner->completed())
+	{
+		for (auto& address : refreshing)
+		{
+			// Not found again, so it's gone
+			entries.erase(address);
+		}
+		complete = complete || wrapped;
+	}
+	for (auto& bank : found)
+	{
+		entries[bank.address] = { bank, now };
+	}
+	stats::DIRECTORY_BANKS = entries.size();
+	++stats::CRAWL_ROUNDS;
+}
+
+bool BankDirectory::ready()
+{
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	return complete;
+}
+
+std::vector<Bank> BankDirectory::banks()
+{
+	std::vector<Bank> res;
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	res.reserve(entries.size());
+	for (auto& entry : entries)
+	{
+		res.emplace_back(entry.second.bank);
+	}
+	return res;
+}
+
+std::shared_ptr<BankDirectory> BankDirectory::_instance;
+
+std::shared_ptr<BankDirectory> BankDirectory::instance()
+{
+	if (_instance == nullptr) _instance.reset(new BankDirectory);
+	return _instance;
+}
@@ -0,0 +1,111 @@
+#include "cancellation.hpp"
+#include <vector>
+#include "exception.hpp"
+
+CancellationToken::State::~State()
+{
+	std::shared_ptr<State> locked = parent.lock();
+	if (locked != nullptr && parentId != 0)
+	{
+		locked->locker.lock();
+		locked->callbacks.erase(parentId);
+		locked->locker.unlock();
+	}
+}
+
+CancellationToken::CancellationToken() : CancellationToken(std::chrono::steady_clock::time_point::max())
+{
+}
+CancellationToken::CancellationToken(std::chrono::steady_clock::time_point deadline)
+{
+	state = std::make_shared<State>();
+	state->deadline = deadline;
+}
+CancellationToken::CancellationToken(std::shared_ptr<State> state)
+{
+	this->state = state;
+}
+CancellationToken::CancellationToken(const CancellationToken& parent, std::chrono::steady_clock::time_point deadline) : CancellationToken(std::min(parent.deadline(), deadline))
+{
+	// The parent only holds a weak reference, so a long-lived parent doesn't keep its children alive
+	std::weak_ptr<State> child = state;
+	state->parent = parent.state;
+	state->parentId = parent.subscribe([child]()
+	{
+		std::shared_ptr<State> locked = child.lock();
+		if (locked != nullptr)
+		{
+			CancellationToken(locked).cancel();
+		}
+	});
+}
+
+void CancellationToken::cancel() const
+{
+	if (state->cancelled.exchange(true))
+	{
+		return;
+	}
+	std::vector<std::function<void()>> callbacks;
+	state->locker.lock();
+	callbacks.reserve(state->callbacks.size());
+	for (auto& callback : state->callbacks)
+	{
+		callbacks.emplace_back(std::move(callback.second));
+	}
+	state->callbacks.clear();
+	state->locker.unlock();
+	for (auto& callback : callbacks)
+	{
+		callback();
+	}
+}
+bool CancellationToken::cancelled() const
+{
+	return state->cancelled || std::chrono::steady_clock::now() >= state->deadline;
+}
+void CancellationToken::check() const
+{
+	if (cancelled())
+	{
+		throw InterbanqaException("Cancelled");
+	}
+}
+std::chrono::steady_clock::time_point CancellationToken::deadline() const
+{
+	return state->deadline;
+}
+
+size_t CancellationToken::subscribe(std::function<void()> callback) const
+{
+	state->locker.lock();
+	if (state->cancelled)
+	{
+		state->locker.unlock();
+		callback();
+		return 0;
+	}
+	size_t id = state->nextId++;
+	state->callbacks[id] = std::move(callback);
+	state->locker.unlock();
+	return id;
+}
+void CancellationToken::unsubscribe(size_t id) const
+{
+	if (id == 0)
+	{
+		return;
+	}
+	state->locker.lock();
+	state->callbacks.erase(id);
+	state->locker.unlock();
+}
+
+CancellationSubscription::CancellationSubscription(const CancellationToken& token, std::function<void()> callback) : token(token)
+{
+	id = token.subscribe(std::move(callback));
+}
+CancellationSubscription::~CancellationSubscription()
+{
+	token.unsubscribe(id);
+}
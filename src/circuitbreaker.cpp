@@ -0,0 +1,168 @@
+#include "circuitbreaker.hpp"
+#include <algorithm>
+#include <vector>
+#include "config.hpp"
+#include "log.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+
+void proberThread(CircuitBreaker* breaker)
+{
+	breaker->probe();
+}
+
+CircuitBreaker::CircuitBreaker()
+{
+}
+
+CircuitBreaker::~CircuitBreaker()
+{
+	stop();
+}
+
+void CircuitBreaker::start()
+{
+	std::lock_guard<std::mutex> lock(breakerLocker);
+	if (running || config::BREAKER_BACKOFF <= 0)
+	{
+		return;
+	}
+	running = true;
+	probing = CancellationToken();
+	prober = std::thread(proberThread, this);
+}
+
+void CircuitBreaker::stop()
+{
+	breakerLocker.lock();
+	running = false;
+	breakerLocker.unlock();
+	probing.cancel();
+	breakerCondition.notify_all();
+	if (prober.joinable())
+	{
+		prober.join();
+	}
+}
+
+void CircuitBreaker::backOff(Circuit& circuit)
+{
+	// Doubles up to the maximum, without overflowing on the way
+	long long int backoff = config::BREAKER_BACKOFF;
+	for (int failure = 1; failure < circuit.failures && backoff < config::BREAKER_BACKOFF_MAX; ++failure)
+	{
+		backoff *= 2;
+	}
+	backoff = std::min<long long int>(backoff, config::BREAKER_BACKOFF_MAX);
+	circuit.retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+}
+
+void CircuitBreaker::probe()
+{
+	std::unique_lock<std::mutex> lock(breakerLocker);
+	while (running)
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto next = std::chrono::steady_clock::time_point::max();
+		std::vector<std::string> due;
+		for (auto& circuit : open)
+		{
+			if (circuit.second.probing) continue;
+			if (circuit.second.retry <= now)
+			{
+				circuit.second.probing = true;
+				due.emplace_back(circuit.first);
+			}
+			else
+			{
+				next = std::min(next, circuit.second.retry);
+			}
+		}
+		if (due.empty())
+		{
+			if (next == std::chrono::steady_clock::time_point::max()) breakerCondition.wait(lock);
+			else breakerCondition.wait_until(lock, next);
+			continue;
+		}
+		CancellationToken token(probing, now + std::chrono::milliseconds((int)(1000 * config::TIMEOUT)));
+		lock.unlock();
+
+		stats::BREAKER_PROBES += due.size();
+		std::shared_ptr<Scanner> scanner = Scanner::targets(due);
+		std::vector<Bank> found = scanner->run(token);
+		bool completed = scanner->completed();
+
+		lock.lock();
+		for (auto& address : due)
+		{
+			auto circuit = open.find(address);
+			if (circuit == open.end()) continue;
+			circuit->second.probing = false;
+			bool answered = std::any_of(found.begin(), found.end(), [&address](const Bank& bank)
+			{
+				return bank.address == address;
+			});
+			if (answered)
+			{
+				runtime_log.log("Bank " + address + " answers again, closing its circuit", LOG_INFO);
+				open.erase(circuit);
+			}
+			else
+			{
+				// A probe cut short by stopping, or one that merely timed out, doesn't count
+				if (completed && !scanner->timedOut(address)) ++circuit->second.failures;
+				backOff(circuit->second);
+			}
+		}
+		stats::BREAKER_OPEN = open.size();
+	}
+}
+
+bool CircuitBreaker::allow(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(breakerLocker);
+	if (open.count(address))
+	{
+		++stats::BREAKER_REJECTIONS;
+		return false;
+	}
+	return true;
+}
+
+void CircuitBreaker::failed(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(breakerLocker);
+	if (!running)
+	{
+		return;
+	}
+	Circuit& circuit = open[address];
+	if (circuit.failures == 0)
+	{
+		runtime_log.log("No bank at " + address + ", opening its circuit", LOG_WARNING);
+	}
+	++circuit.failures;
+	if (!circuit.probing)
+	{
+		backOff(circuit);
+	}
+	stats::BREAKER_OPEN = open.size();
+	breakerCondition.notify_all();
+}
+
+void CircuitBreaker::succeeded(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(breakerLocker);
+	if (open.erase(address))
+	{
+		stats::BREAKER_OPEN = open.size();
+	}
+}
+
+std::shared_ptr<CircuitBreaker> CircuitBreaker::_instance;
+
+std::shared_ptr<CircuitBreaker> CircuitBreaker::instance()
+{
+	if (_instance == nullptr) _instance.reset(new CircuitBreaker);
+	return _instance;
+}
@@ -1,80 +1,220 @@
 #include "client.hpp"
-#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <boost/asio.hpp>
 #include "bank.hpp"
+#include "circuitbreaker.hpp"
 #include "exception.hpp"
 #include "networking/connection.hpp"
+#include "networking/peerpool.hpp"
 #include "networking/socket.hpp"
+#include "networking/reactor.hpp"
+#include "gossip.hpp"
 #include "log.hpp"
+#include "planner.hpp"
+#include "portdirectory.hpp"
+#include "scanner.hpp"
 #include "database/account.hpp"
 #include "config.hpp"
 #include "stringops.hpp"
+#include "stats.hpp"
+#include "workerpool.hpp"
 
 void Client::respond(const std::string& message)
 {
-	runtime_log.log("Response to " + socket->raw()->remote_endpoint().address().to_string() + ": " + message, LOG_INFO);
-	socket->send(message + "\r\n");
+	runtime_log.log("Response to " + address + ": " + message, LOG_INFO);
+	if (socket->isOpen())
+	{
+		socket->send(message + "\r\n");
+	}
 }
 
-std::string actuallyForwardRequest(const std::string& cmd, std::string address, int port)
+std::string actuallyForwardRequest(const std::string& cmd, std::string address, int port, CancellationToken token, bool exclusive)
 {
-	Connection connection;
-	connection.connectV4(address, std::to_string(port));
-	connection.send(cmd + "\r\n");
-	while (connection.pending() <= 0)
-	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	}
-	Packet response = connection.next();
+	Packet response = PeerPool::instance()->request(address, port, cmd, token, exclusive);
 	std::string answer = reassembeCommand(parseCommand(response.data()));
 	runtime_log.log("Received '" + answer + "' from " + address + ", port " + std::to_string(port), LOG_INFO);
 	return answer;
 }
 
-std::string Client::forwardRequest(const std::vector<std::string>& arguments, std::string address)
+/**
+ * The attempts of a hedged request, racing to answer first.
+ */
+struct Hedge
+{
+	std::mutex locker;
+	std::condition_variable condition;
+	std::string answer;
+	/// Index of the attempt that answered, -1 while none did.
+	int winner = -1;
+	int failures = 0;
+	std::exception_ptr failure;
+};
+
+/**
+ * Starts one attempt of a hedged request on the Reactor. The first attempt to answer wins.
+ */
+void hedgeAttempt(std::shared_ptr<Hedge> hedge, int index, const std::string& cmd, std::string address, int port, const CancellationToken& token)
+{
+	PeerPool::instance()->requestAsync(address, port, cmd, token, [hedge, index, address, port](std::exception_ptr failure, const Packet& response)
+	{
+		std::string answer;
+		if (!failure)
+		{
+			answer = reassembeCommand(parseCommand(response.data()));
+			runtime_log.log("Received '" + answer + "' from " + address + ", port " + std::to_string(port), LOG_INFO);
+		}
+		std::lock_guard<std::mutex> lock(hedge->locker);
+		if (failure)
+		{
+			++hedge->failures;
+			hedge->failure = failure;
+		}
+		else if (hedge->winner < 0)
+		{
+			hedge->answer = answer;
+			hedge->winner = index;
+		}
+		hedge->condition.notify_all();
+	});
+}
+
+/**
+ * Forwards a read-only request like actuallyForwardRequest(), but if the bank takes longer than it usually does
+ * (config::HEDGE_PERCENTILE of its round trip times), sends it once more over another connection.
+ * Both attempts run on the Reactor. Whichever answers first wins, and the other one's connection is closed right away.
+ */
+std::string hedgedForwardRequest(const std::string& cmd, std::string address, int port, const CancellationToken& token)
+{
+	std::chrono::microseconds delay = PeerPool::instance()->percentile(address, port, config::HEDGE_PERCENTILE);
+	if (delay.count() == 0)
+	{
+		return actuallyForwardRequest(cmd, address, port, token, false);
+	}
+
+	std::shared_ptr<Hedge> hedge = std::make_shared<Hedge>();
+	CancellationToken racing(token, token.deadline());
+	hedgeAttempt(hedge, 0, cmd, address, port, racing);
+
+	std::unique_lock<std::mutex> lock(hedge->locker);
+	int launched = 1;
+	auto finished = [&hedge, &launched]()
+	{
+		return hedge->winner >= 0 || hedge->failures >= launched;
+	};
+	if (!hedge->condition.wait_for(lock, delay, finished) && !token.cancelled())
+	{
+		++stats::HEDGES_FIRED;
+		runtime_log.log("Hedging request '" + cmd + "' to " + address + ", no answer within " + std::to_string(delay.count()) + " us", LOG_INFO);
+		hedgeAttempt(hedge, 1, cmd, address, port, racing);
+		++launched;
+	}
+	hedge->condition.wait_until(lock, token.deadline(), finished);
+	int winner = hedge->winner;
+	std::string answer = hedge->answer;
+	std::exception_ptr failure = hedge->failure;
+	lock.unlock();
+
+	// Closes the losing attempt's connection through its subscription to the token
+	racing.cancel();
+	if (winner > 0) ++stats::HEDGES_WON;
+	if (winner >= 0) return answer;
+	if (failure) std::rethrow_exception(failure);
+	token.check();
+	throw InterbanqaException("No response from " + address);
+}
+
+std::string Client::forwardRequest(const std::vector<std::string>& arguments, std::string address, const CancellationToken& token)
 {
 	std::string cmd = reassembeCommand(arguments);
+	std::shared_ptr<CircuitBreaker> breaker = CircuitBreaker::instance();
+	if (!breaker->allow(address))
+	{
+		throw InterbanqaException("Bank not found");
+	}
 	runtime_log.log("Forwarding request '" + cmd + "' to " + address, LOG_WARNING);
-	std::vector<std::future<std::string>> requests;
-	requests.reserve(config::MAX_PORT - config::MIN_PORT + 1);
-	for (int port = config::MIN_PORT; port <= config::MAX_PORT; ++port)
+	const std::chrono::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds((int)(1000 * config::TIMEOUT));
+	CancellationToken forwarding(token, end);
+
+	std::shared_ptr<PortDirectory> directory = PortDirectory::instance();
+	int known = directory->find(address);
+	if (known != 0)
 	{
-		requests.emplace_back(std::async(std::launch::async, actuallyForwardRequest, cmd, address, port));
+		// The bank's own timeout, judging by how fast it answered before
+		CancellationToken attempt(forwarding, std::chrono::steady_clock::now() + PeerPool::instance()->timeout(address, known));
+		try
+		{
+			std::string answer;
+			if (config::HEDGE && PeerPool::readOnly(cmd)) answer = hedgedForwardRequest(cmd, address, known, attempt);
+			else answer = actuallyForwardRequest(cmd, address, known, attempt, false);
+			directory->learn(address, known);
+			breaker->succeeded(address);
+			return answer;
+		}
+		catch (const std::exception& e)
+		{
+			token.check();
+			if (attempt.cancelled() && !forwarding.cancelled())
+			{
+				// Still there, just slower than usual
+				runtime_log.log("Bank " + address + " timed out on port " + std::to_string(known), LOG_WARNING);
+				throw InterbanqaException("Bank timed out");
+			}
+			// Once connected, the bank may have applied a change before the connection died, so only reads look elsewhere
+			bool connected = dynamic_cast<const boost::system::system_error*>(&e) == nullptr;
+			if (connected && !PeerPool::readOnly(cmd))
+			{
+				throw;
+			}
+			runtime_log.log("Bank " + address + " no longer answers on port " + std::to_string(known) + ": " + e.what(), LOG_WARNING);
+			directory->forget(address, known);
+		}
 	}
-	const std::chrono::time_point start = std::chrono::system_clock::now();
-	const std::chrono::time_point end = start + std::chrono::milliseconds((int)(1000 * config::TIMEOUT));
-	for (auto& r : requests)
+
+	// Finds the ports anything listens on with plain connects, a window at a time on the Reactor, then forwards the
+	// request to those only, so whether the bank answers is up to the request itself
+	std::shared_ptr<Scanner> scanner = Scanner::listeners(address);
+	scanner->run(forwarding);
+	for (int port : scanner->ports(address))
 	{
 		try
 		{
-			auto status = r.wait_until(end);
-			if (status == std::future_status::timeout) InterbanqaException("Timeout");
-			else return r.get();
+			std::string answer = actuallyForwardRequest(cmd, address, port, forwarding, false);
+			directory->learn(address, port);
+			breaker->succeeded(address);
+			return answer;
 		}
-		catch (const boost::wrapexcept<boost::system::system_error>& error)
+		catch (const std::exception& e)
 		{
-			switch (error.code().value())
+			token.check();
+			if (forwarding.cancelled())
 			{
-				case boost::asio::error::host_unreachable:
-				case boost::asio::error::connection_refused:
-					break;
-				default:
-					throw;
+				runtime_log.log("Bank " + address + " timed out on port " + std::to_string(port), LOG_WARNING);
+				throw InterbanqaException("Bank timed out");
 			}
+			runtime_log.log("No bank answers " + address + " on port " + std::to_string(port) + ": " + e.what(), LOG_INFO);
 		}
 	}
+	token.check();
+	// Only when nothing listens at all, a host that merely didn't accept in time keeps its circuit closed
+	if (scanner->completed() && scanner->ports(address).empty() && !scanner->timedOut(address))
+	{
+		breaker->failed(address);
+	}
 	throw InterbanqaException("Bank not found");
 }
 
-std::string Client::bankCode(const std::vector<std::string>& arguments)
+std::string Client::bankCode(const std::vector<std::string>&, const CancellationToken&)
 {
 	return "BC " + config::ADDRESS;
 }
-std::string Client::accountCreate(const std::vector<std::string>& arguments)
+std::string Client::accountCreate(const std::vector<std::string>&, const CancellationToken& token)
 {
+	token.check();
 	Account account = Account::create();
 	return "AC " + std::to_string(account.number()) + "/" + config::ADDRESS;
 }
-std::string Client::accountDeposit(const std::vector<std::string>& arguments)
+std::string Client::accountDeposit(const std::vector<std::string>& arguments, const CancellationToken& token)
 {
 	if (arguments.size() < 3)
 	{
@@ -88,16 +228,16 @@ std::string Client::accountDeposit(const std::vector<std::string>& arguments)
 	if (raw_addr[1] == config::ADDRESS)
 	{
 		int number = std::stoi(raw_addr[0]);
-		Account account = Account::get(number);
-		account.deposit(std::stoll(arguments[2]));
+		token.check();
+		Account::deposit(number, std::stoll(arguments[2]));
 		return "AD";
 	}
 	else
 	{
-		return forwardRequest(arguments, raw_addr[1]);
+		return forwardRequest(arguments, raw_addr[1], token);
 	}
 }
-std::string Client::accountWithdrawal(const std::vector<std::string>& arguments)
+std::string Client::accountWithdrawal(const std::vector<std::string>& arguments, const CancellationToken& token)
 {
 	if (arguments.size() < 3)
 	{
@@ -111,16 +251,16 @@ std::string Client::accountWithdrawal(const std::vector<std::string>& arguments)
 	if (raw_addr[1] == config::ADDRESS)
 	{
 		int number = std::stoi(raw_addr[0]);
-		Account account = Account::get(number);
-		account.withdraw(std::stoll(arguments[2]));
+		token.check();
+		Account::withdraw(number, std::stoll(arguments[2]));
 		return "AW";
 	}
 	else
 	{
-		return forwardRequest(arguments, raw_addr[1]);
+		return forwardRequest(arguments, raw_addr[1], token);
 	}
 }
-std::string Client::accountBalance(const std::vector<std::string>& arguments)
+std::string Client::accountBalance(const std::vector<std::string>& arguments, const CancellationToken& token)
 {
 	if (arguments.size() < 2)
 	{
@@ -134,15 +274,16 @@ std::string Client::accountBalance(const std::vector<std::string>& arguments)
 	if (raw_addr[1] == config::ADDRESS)
 	{
 		int number = std::stoi(raw_addr[0]);
+		token.check();
 		Account account = Account::get(number);
 		return "AB " + std::to_string(account.balance());
 	}
 	else
 	{
-		return forwardRequest(arguments, raw_addr[1]);
+		return forwardRequest(arguments, raw_addr[1], token);
 	}
 }
-std::string Client::accountRemove(const std::vector<std::string>& arguments)
+std::string Client::accountRemove(const std::vector<std::string>& arguments, const CancellationToken& token)
 {
 	if (arguments.size() < 2)
 	{
@@ -156,23 +297,43 @@ std::string Client::accountRemove(const std::vector<std::string>& arguments)
 	if (raw_addr[1] == config::ADDRESS)
 	{
 		int number = std::stoi(raw_addr[0]);
+		token.check();
 		Account::remove(number);
 		return "AR";
 	}
 	else
 	{
-		return forwardRequest(arguments, raw_addr[1]);
+		return forwardRequest(arguments, raw_addr[1], token);
 	}
 }
-std::string Client::bankTotalAmount(const std::vector<std::string>& arguments)
+std::string Client::bankTotalAmount(const std::vector<std::string>&, const CancellationToken& token)
 {
+	token.check();
 	return "BA " + std::to_string(Account::funds());
 }
-std::string Client::bankNumberOfClients(const std::vector<std::string>& arguments)
+std::string Client::bankNumberOfClients(const std::vector<std::string>&, const CancellationToken& token)
 {
+	token.check();
 	return "BN " + std::to_string(Account::count());
 }
-std::string Client::robberyPlan(const std::vector<std::string>& arguments)
+std::string Client::bankStatistics(const std::vector<std::string>&, const CancellationToken& token)
+{
+	token.check();
+	BankStatistics statistics = Account::statistics();
+	return "BS " + std::to_string(statistics.funds) + " " + std::to_string(statistics.clients) + " " + std::to_string(statistics.version);
+}
+std::string Client::bankGossip(const std::vector<std::string>& arguments, const CancellationToken& token)
+{
+	if (!config::GOSSIP)
+	{
+		throw InterbanqaException("Gossip is disabled");
+	}
+	token.check();
+	std::shared_ptr<Gossip> gossip = Gossip::instance();
+	gossip->merge(arguments);
+	return gossip->digest();
+}
+std::string Client::robberyPlan(const std::vector<std::string>& arguments, const CancellationToken& token)
 {
 	if (arguments.size() < 2)
 	{
@@ -180,26 +341,14 @@ std::string Client::robberyPlan(const std::vector<std::string>& arguments)
 	}
 	long long int target = std::stoll(arguments[1]);
 
-	std::multiset<Bank> banks = Bank::listBanks();
-
-	long long int total = 0;
-	for (auto& b : banks)
-	{
-		total += b.balance;
-	}
-	if (total < target)
-	{
-		throw InterbanqaException("Not enough finances in network");
-	}
+	std::multiset<Bank> found = Bank::listBanks(token);
+	token.check();
+	RobberyPlan plan = Planner::plan(std::vector<Bank>(found.begin(), found.end()), target);
 
 	std::set<std::string> to_rob;
-	int clients = 0;
-	total = 0;
-	for (auto it = banks.rbegin(); it != banks.rend() && total < target; ++it)
+	for (auto& b : plan.banks)
 	{
-		total += it->balance;
-		clients += it->clients;
-		to_rob.emplace(it->address);
+		to_rob.emplace(b.address);
 	}
 
 	std::string bank_addrs = "";
@@ -214,15 +363,17 @@ std::string Client::robberyPlan(const std::vector<std::string>& arguments)
 		do_comma = true;
 	}
 
-	return "RP for " + std::to_string(total) + "$ (" + std::to_string(clients) + " clients): " + bank_addrs;
+	return "RP for " + std::to_string(plan.total) + "$ (" + std::to_string(plan.clients) + " clients): " + bank_addrs;
 }
 
 
-std::unordered_map<std::string, std::string(*)(const std::vector<std::string>& arguments)> Client::commands;
+std::unordered_map<std::string, std::string(*)(const std::vector<std::string>& arguments, const CancellationToken& token)> Client::commands;
 
 Client::Client(std::shared_ptr<Socket> socket)
 {
 	this->socket = socket;
+	boost::system::error_code error;
+	address = socket->raw()->remote_endpoint(error).address().to_string();
 
 	commands["BC"] = &Client::bankCode;
 	commands["AC"] = &Client::accountCreate;
@@ -232,44 +383,194 @@ Client::Client(std::shared_ptr<Socket> socket)
 	commands["AR"] = &Client::accountRemove;
 	commands["BA"] = &Client::bankTotalAmount;
 	commands["BN"] = &Client::bankNumberOfClients;
-	//commands["RP"] = &Client::robberyPlan; // BORKED
+	commands["BS"] = &Client::bankStatistics;
+	commands["GS"] = &Client::bankGossip;
+	commands["RP"] = &Client::robberyPlan;
+}
+
+/// Negotiates request IDs (see Client::multiplexed), answered with "XM 1".
+const char MULTIPLEX_COMMAND[] = "XM";
+
+struct Client::Request
+{
+	std::atomic<bool> done = false;
+	/// Claimed by the worker running the command, or by the timeout if it comes first.
+	std::atomic<bool> started = false;
+	/// "#id " of a multiplexed request, empty otherwise.
+	std::string tag;
+	CancellationToken token;
+	boost::asio::strand<boost::asio::io_context::executor_type> strand;
+	boost::asio::steady_timer timeout;
+
+	Request(const std::string& tag, std::chrono::steady_clock::time_point deadline) : tag(tag), token(deadline), strand(boost::asio::make_strand(Reactor::instance()->context())), timeout(strand)
+	{
+	}
+};
+
+void Client::notify()
+{
+	advance();
 }
 
-void Client::run()
+void Client::advance()
 {
-	std::shared_ptr<boost::asio::ip::tcp::socket> bsocket;
-	while (socket->isOpen())
+	std::vector<Packet> packets;
+	while (true)
 	{
-		while (socket->pending() > 0)
+		clientLocker.lock();
+		size_t limit = multiplexed ? (size_t)config::MAX_INFLIGHT : 1;
+		if (running >= limit || socket->congested() || socket->next(packets, 1) <= 0)
+		{
+			clientLocker.unlock();
+			return;
+		}
+		++running;
+		clientLocker.unlock();
+
+		bool submitted = start(packets[0]);
+		packets.clear();
+		if (submitted)
+		{
+			continue;
+		}
+		socket->handled();
+		clientLocker.lock();
+		--running;
+		clientLocker.unlock();
+	}
+}
+
+bool Client::start(const Packet& packet)
+{
+	std::string tag;
+	std::string line = packet.data();
+	if (multiplexed)
+	{
+		if (line.empty() || line[0] != '#')
+		{
+			respond("ER Missing request ID");
+			return false;
+		}
+		size_t separator = line.find(' ');
+		tag = line.substr(0, separator) + " ";
+		line = (separator == std::string::npos ? "" : line.substr(separator + 1));
+	}
+	if (packet.shed())
+	{
+		++stats::REQUESTS_SHED;
+		respond(tag + "ER busy");
+		return false;
+	}
+	try
+	{
+		std::vector<std::string> arguments = parseCommand(line);
+		if (arguments.size() <= 0)
+		{
+			// A multiplexed peer waits for an answer to every ID
+			if (!tag.empty()) respond(tag + "ER Empty request");
+			return false;
+		}
+		std::string cmdToLog = reassembeCommand(arguments);
+		runtime_log.log("Request from " + address + ": " + tag + cmdToLog, LOG_INFO);
+		if (arguments[0] == MULTIPLEX_COMMAND)
+		{
+			multiplexed = true;
+			respond(tag + MULTIPLEX_COMMAND + " 1");
+			return false;
+		}
+		if (!commands.count(arguments[0]))
+		{
+			throw InterbanqaException("Command not found");
+		}
+		auto command = commands[arguments[0]];
+
+		std::shared_ptr<Client> self = shared_from_this();
+		std::shared_ptr<Request> request = std::make_shared<Request>(tag, std::chrono::steady_clock::now() + std::chrono::milliseconds((int)(1000 * config::TIMEOUT)));
+		request->timeout.expires_at(request->token.deadline());
+		request->timeout.async_wait([self, request](const boost::system::error_code& error)
+		{
+			if (error) return;
+			request->token.cancel();
+			++stats::REQUESTS_TIMED_OUT;
+			if (request->started.exchange(true))
+			{
+				// The command may be changing something, so it answers once it has stopped, not before
+				runtime_log.log("When handling request for " + self->address + ": Timed out, stopping the command", LOG_WARNING);
+				return;
+			}
+			runtime_log.log("When handling request for " + self->address + ": Timed out", LOG_ERROR);
+			self->finish(request, "ER Timed out");
+		});
+		bool submitted = WorkerPool::instance()->submit([self, request, command, arguments]()
 		{
+			if (request->started.exchange(true))
+			{
+				// Timed out while queued, already answered
+				return;
+			}
+			if (request->token.cancelled())
+			{
+				runtime_log.log("When handling request for " + self->address + ": Timed out", LOG_ERROR);
+				self->finish(request, "ER Timed out");
+				return;
+			}
+			std::string response;
 			try
 			{
-				Packet packet = socket->next();
-				bsocket = packet.socket();
-				std::vector<std::string> arguments = parseCommand(packet.data());
-				if (arguments.size() <= 0) continue;
-				std::string cmdToLog = reassembeCommand(arguments);
-				runtime_log.log("Request from " + bsocket->remote_endpoint().address().to_string() + ": " + cmdToLog, LOG_INFO);
-				if (commands.count(arguments[0]))
-				{
-					std::future<std::string> awaited_response = std::async(std::launch::async, commands[arguments[0]], arguments);
-					auto status = awaited_response.wait_for(std::chrono::milliseconds((int)(1000*config::TIMEOUT)));
-					if (status == std::future_status::timeout)
-					{
-						throw InterbanqaException("Timed out");
-					}
-					respond(awaited_response.get());
-				}
-				else
-				{
-					throw InterbanqaException("Command not found");
-				}
+				response = command(arguments, request->token);
 			}
 			catch (const std::exception& e)
 			{
-				runtime_log.log("When handling request"  + (bsocket != nullptr ? " for " + bsocket->remote_endpoint().address().to_string() : "") + ": " + e.what(), LOG_ERROR);
-				respond((std::string)"ER " + e.what());
+				runtime_log.log("When handling request for " + self->address + ": " + e.what(), LOG_ERROR);
+				response = (std::string)"ER " + e.what();
+				// Stopped by the timeout
+				if (request->token.cancelled()) response = "ER Timed out";
 			}
+			self->finish(request, response);
+		});
+		if (!submitted)
+		{
+			request->done = true;
+			boost::asio::post(request->strand, [request]()
+			{
+				request->timeout.cancel();
+			});
+			++stats::REQUESTS_SHED;
+			respond(tag + "ER busy");
+			return false;
 		}
+		++stats::REQUESTS_HANDLED;
+		return true;
+	}
+	catch (const std::exception& e)
+	{
+		runtime_log.log("When handling request for " + address + ": " + e.what(), LOG_ERROR);
+		respond(tag + "ER " + e.what());
+		return false;
+	}
+}
+
+void Client::finish(std::shared_ptr<Request> request, const std::string& response)
+{
+	if (request->done.exchange(true))
+	{
+		return;
+	}
+	boost::asio::post(request->strand, [request]()
+	{
+		request->timeout.cancel();
+	});
+	try
+	{
+		respond(request->tag + response);
+	}
+	catch (const std::exception& e)
+	{
+		runtime_log.log("Couldn't respond to " + address + ": " + e.what(), LOG_WARNING);
 	}
+	socket->handled();
+	clientLocker.lock();
+	--running;
+	clientLocker.unlock();
+	advance();
 }
\ No newline at end of file
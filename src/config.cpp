@@ -11,6 +11,42 @@ const char CONFIG_PORT_NAME[] = "port";
 const char CONFIG_ADDRESS_NAME[] = "address";
 const char CONFIG_PREFIX_LENGTH_NAME[] = "prefix";
 const char CONFIG_TIMEOUT_NAME[] = "timeout";
+const char CONFIG_IO_THREADS_NAME[] = "io_threads";
+const char CONFIG_WORKER_THREADS_NAME[] = "worker_threads";
+const char CONFIG_WORKER_QUEUE_NAME[] = "worker_queue";
+const char CONFIG_QUEUE_DEPTH_NAME[] = "queue_depth";
+const char CONFIG_SEND_HIGH_WATER_NAME[] = "send_high_water";
+const char CONFIG_MAX_CONNECTIONS_NAME[] = "max_connections";
+const char CONFIG_MAX_CONNECTIONS_PER_IP_NAME[] = "max_connections_per_ip";
+const char CONFIG_MAX_INFLIGHT_NAME[] = "max_inflight";
+const char CONFIG_PORT_CACHE_TTL_NAME[] = "port_cache_ttl";
+const char CONFIG_PORT_CACHE_PATH_NAME[] = "port_cache_path";
+const char CONFIG_PEER_POOL_SIZE_NAME[] = "peer_pool_size";
+const char CONFIG_PEER_IDLE_TIMEOUT_NAME[] = "peer_idle_timeout";
+const char CONFIG_PEER_MULTIPLEX_NAME[] = "peer_multiplex";
+const char CONFIG_SCAN_CONCURRENCY_NAME[] = "scan_concurrency";
+const char CONFIG_SCAN_PROBE_TIMEOUT_NAME[] = "scan_probe_timeout";
+const char CONFIG_CRAWL_NAME[] = "crawl";
+const char CONFIG_CRAWL_INTERVAL_NAME[] = "crawl_interval";
+const char CONFIG_CRAWL_BATCH_NAME[] = "crawl_batch";
+const char CONFIG_CRAWL_REFRESH_NAME[] = "crawl_refresh";
+const char CONFIG_GOSSIP_NAME[] = "gossip";
+const char CONFIG_GOSSIP_INTERVAL_NAME[] = "gossip_interval";
+const char CONFIG_GOSSIP_FANOUT_NAME[] = "gossip_fanout";
+const char CONFIG_DISCOVERY_NAME[] = "discovery";
+const char CONFIG_DISCOVERY_GROUP_NAME[] = "discovery_group";
+const char CONFIG_DISCOVERY_PORT_NAME[] = "discovery_port";
+const char CONFIG_DISCOVERY_INTERVAL_NAME[] = "discovery_interval";
+const char CONFIG_SEEDS_NAME[] = "seeds";
+const char CONFIG_BREAKER_BACKOFF_NAME[] = "breaker_backoff";
+const char CONFIG_BREAKER_BACKOFF_MAX_NAME[] = "breaker_backoff_max";
+const char CONFIG_HEDGE_NAME[] = "hedge";
+const char CONFIG_HEDGE_PERCENTILE_NAME[] = "hedge_percentile";
+const char CONFIG_DB_READERS_NAME[] = "db_readers";
+const char CONFIG_DB_SYNCHRONOUS_NAME[] = "db_synchronous";
+const char CONFIG_DB_CHECKPOINT_NAME[] = "db_checkpoint";
+const char CONFIG_DB_DURABILITY_NAME[] = "db_durability";
+const char CONFIG_DB_COMMIT_WINDOW_NAME[] = "db_commit_window";
 
 namespace config
 {
@@ -20,6 +56,118 @@ namespace config
 	std::string ADDRESS = "0.0.0.0";
 	int PREFIX_LENGTH = 24;
 	double TIMEOUT = 5;
+
+	int IO_THREADS = 0;
+	int WORKER_THREADS = 16;
+	int WORKER_QUEUE = 4096;
+	int QUEUE_DEPTH = 256;
+	int SEND_HIGH_WATER = 65536;
+	int MAX_CONNECTIONS = 10000;
+	int MAX_CONNECTIONS_PER_IP = 1000;
+	int MAX_INFLIGHT = 64;
+	int PORT_CACHE_TTL = 300;
+	std::string PORT_CACHE_PATH = "port_cache.json";
+	int PEER_POOL_SIZE = 4;
+	int PEER_IDLE_TIMEOUT = 30;
+	bool PEER_MULTIPLEX = true;
+	int SCAN_CONCURRENCY = 256;
+	int SCAN_PROBE_TIMEOUT = 500;
+	bool CRAWL = true;
+	int CRAWL_INTERVAL = 1000;
+	int CRAWL_BATCH = 16;
+	int CRAWL_REFRESH = 30;
+	bool GOSSIP = false;
+	int GOSSIP_INTERVAL = 1000;
+	int GOSSIP_FANOUT = 3;
+	bool DISCOVERY = true;
+	std::string DISCOVERY_GROUP = "239.255.73.81";
+	int DISCOVERY_PORT = 65524;
+	int DISCOVERY_INTERVAL = 10;
+	std::vector<std::string> SEEDS;
+	int BREAKER_BACKOFF = 1000;
+	int BREAKER_BACKOFF_MAX = 60000;
+	bool HEDGE = false;
+	int HEDGE_PERCENTILE = 95;
+	int DB_READERS = 0;
+	std::string DB_SYNCHRONOUS = "full";
+	int DB_CHECKPOINT = 1000;
+	std::string DB_DURABILITY = "group";
+	int DB_COMMIT_WINDOW = 0;
+}
+
+/**
+ * Loads an optional unsigned integer entry, leaving the default in place if it's absent.
+ */
+void loadOptionalUnsigned(const nlohmann::json& raw, const char* name, int& target, int minimum)
+{
+	if (!raw.contains(name))
+	{
+		return;
+	}
+	if (!raw[name].is_number_unsigned())
+	{
+		throw InterbanqaException((std::string)"Config entry " + name + " must be an unsigned integer");
+	}
+	if (raw[name] < minimum)
+	{
+		throw InterbanqaException((std::string)"Config entry " + name + " must be at least " + std::to_string(minimum));
+	}
+	target = raw[name];
+}
+/**
+ * Loads an optional boolean entry, leaving the default in place if it's absent.
+ */
+void loadOptionalBool(const nlohmann::json& raw, const char* name, bool& target)
+{
+	if (!raw.contains(name))
+	{
+		return;
+	}
+	if (!raw[name].is_boolean())
+	{
+		throw InterbanqaException((std::string)"Config entry " + name + " must be true or false");
+	}
+	target = raw[name];
+}
+/**
+ * Loads an optional string entry, leaving the default in place if it's absent.
+ */
+void loadOptionalString(const nlohmann::json& raw, const char* name, std::string& target)
+{
+	if (!raw.contains(name))
+	{
+		return;
+	}
+	if (!raw[name].is_string())
+	{
+		throw InterbanqaException((std::string)"Config entry " + name + " must be a string");
+	}
+	target = raw[name];
+}
+
+/**
+ * Loads an optional array of strings, leaving the default in place if it's absent.
+ */
+void loadOptionalStrings(const nlohmann::json& raw, const char* name, std::vector<std::string>& target)
+{
+	if (!raw.contains(name))
+	{
+		return;
+	}
+	if (!raw[name].is_array())
+	{
+		throw InterbanqaException((std::string)"Config entry " + name + " must be an array of strings");
+	}
+	std::vector<std::string> res;
+	for (auto& item : raw[name])
+	{
+		if (!item.is_string())
+		{
+			throw InterbanqaException((std::string)"Config entry " + name + " must be an array of strings");
+		}
+		res.emplace_back(item);
+	}
+	target = res;
 }
 
 void initConfig()
@@ -109,4 +257,67 @@ void initConfig()
 	config::ADDRESS = raw[CONFIG_ADDRESS_NAME];
 	config::PREFIX_LENGTH = raw[CONFIG_PREFIX_LENGTH_NAME];
 	config::TIMEOUT = raw[CONFIG_TIMEOUT_NAME];
+
+	loadOptionalUnsigned(raw, CONFIG_IO_THREADS_NAME, config::IO_THREADS, 0);
+	loadOptionalUnsigned(raw, CONFIG_WORKER_THREADS_NAME, config::WORKER_THREADS, 1);
+	loadOptionalUnsigned(raw, CONFIG_WORKER_QUEUE_NAME, config::WORKER_QUEUE, 1);
+	loadOptionalUnsigned(raw, CONFIG_QUEUE_DEPTH_NAME, config::QUEUE_DEPTH, 2);
+	loadOptionalUnsigned(raw, CONFIG_SEND_HIGH_WATER_NAME, config::SEND_HIGH_WATER, 1);
+	loadOptionalUnsigned(raw, CONFIG_MAX_CONNECTIONS_NAME, config::MAX_CONNECTIONS, 1);
+	loadOptionalUnsigned(raw, CONFIG_MAX_CONNECTIONS_PER_IP_NAME, config::MAX_CONNECTIONS_PER_IP, 1);
+	loadOptionalUnsigned(raw, CONFIG_MAX_INFLIGHT_NAME, config::MAX_INFLIGHT, 1);
+	loadOptionalUnsigned(raw, CONFIG_PORT_CACHE_TTL_NAME, config::PORT_CACHE_TTL, 0);
+	loadOptionalString(raw, CONFIG_PORT_CACHE_PATH_NAME, config::PORT_CACHE_PATH);
+	loadOptionalUnsigned(raw, CONFIG_PEER_POOL_SIZE_NAME, config::PEER_POOL_SIZE, 0);
+	loadOptionalUnsigned(raw, CONFIG_PEER_IDLE_TIMEOUT_NAME, config::PEER_IDLE_TIMEOUT, 1);
+	loadOptionalBool(raw, CONFIG_PEER_MULTIPLEX_NAME, config::PEER_MULTIPLEX);
+	loadOptionalUnsigned(raw, CONFIG_SCAN_CONCURRENCY_NAME, config::SCAN_CONCURRENCY, 1);
+	loadOptionalUnsigned(raw, CONFIG_SCAN_PROBE_TIMEOUT_NAME, config::SCAN_PROBE_TIMEOUT, 1);
+	loadOptionalBool(raw, CONFIG_CRAWL_NAME, config::CRAWL);
+	loadOptionalUnsigned(raw, CONFIG_CRAWL_INTERVAL_NAME, config::CRAWL_INTERVAL, 1);
+	loadOptionalUnsigned(raw, CONFIG_CRAWL_BATCH_NAME, config::CRAWL_BATCH, 1);
+	loadOptionalUnsigned(raw, CONFIG_CRAWL_REFRESH_NAME, config::CRAWL_REFRESH, 0);
+	loadOptionalBool(raw, CONFIG_GOSSIP_NAME, config::GOSSIP);
+	loadOptionalUnsigned(raw, CONFIG_GOSSIP_INTERVAL_NAME, config::GOSSIP_INTERVAL, 1);
+	loadOptionalUnsigned(raw, CONFIG_GOSSIP_FANOUT_NAME, config::GOSSIP_FANOUT, 1);
+	loadOptionalBool(raw, CONFIG_DISCOVERY_NAME, config::DISCOVERY);
+	loadOptionalString(raw, CONFIG_DISCOVERY_GROUP_NAME, config::DISCOVERY_GROUP);
+	if (!boost::regex_match(config::DISCOVERY_GROUP, addr_regex))
+	{
+		throw InterbanqaException("Config entry discovery_group must be an IPv4 address");
+	}
+	loadOptionalUnsigned(raw, CONFIG_DISCOVERY_PORT_NAME, config::DISCOVERY_PORT, 1);
+	loadOptionalUnsigned(raw, CONFIG_DISCOVERY_INTERVAL_NAME, config::DISCOVERY_INTERVAL, 1);
+	loadOptionalStrings(raw, CONFIG_SEEDS_NAME, config::SEEDS);
+	boost::regex seed_regex("\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}\\.\\d{1,3}:\\d{1,5}");
+	for (auto& seed : config::SEEDS)
+	{
+		if (!boost::regex_match(seed, seed_regex))
+		{
+			throw InterbanqaException("Config entry seeds must list IPv4 addresses with ports, e.g. 10.0.0.2:65525");
+		}
+	}
+	loadOptionalUnsigned(raw, CONFIG_BREAKER_BACKOFF_NAME, config::BREAKER_BACKOFF, 0);
+	loadOptionalUnsigned(raw, CONFIG_BREAKER_BACKOFF_MAX_NAME, config::BREAKER_BACKOFF_MAX, 1);
+	loadOptionalBool(raw, CONFIG_HEDGE_NAME, config::HEDGE);
+	loadOptionalUnsigned(raw, CONFIG_HEDGE_PERCENTILE_NAME, config::HEDGE_PERCENTILE, 1);
+	if (config::HEDGE_PERCENTILE > 100)
+	{
+		throw InterbanqaException("Config entry hedge_percentile must be 1-100");
+	}
+	loadOptionalUnsigned(raw, CONFIG_DB_READERS_NAME, config::DB_READERS, 0);
+	loadOptionalString(raw, CONFIG_DB_SYNCHRONOUS_NAME, config::DB_SYNCHRONOUS);
+	boost::regex synchronous_regex("off|normal|full|extra");
+	if (!boost::regex_match(config::DB_SYNCHRONOUS, synchronous_regex))
+	{
+		throw InterbanqaException("Config entry db_synchronous must be off, normal, full or extra");
+	}
+	loadOptionalUnsigned(raw, CONFIG_DB_CHECKPOINT_NAME, config::DB_CHECKPOINT, 0);
+	loadOptionalString(raw, CONFIG_DB_DURABILITY_NAME, config::DB_DURABILITY);
+	boost::regex durability_regex("op|group|async");
+	if (!boost::regex_match(config::DB_DURABILITY, durability_regex))
+	{
+		throw InterbanqaException("Config entry db_durability must be op, group or async");
+	}
+	loadOptionalUnsigned(raw, CONFIG_DB_COMMIT_WINDOW_NAME, config::DB_COMMIT_WINDOW, 0);
 }
\ No newline at end of file
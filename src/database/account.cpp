@@ -1,9 +1,48 @@
 #include "database/account.hpp"
+#include <chrono>
+#include <limits>
+#include <mutex>
 #include "database/singleton.hpp"
 #include "exception.hpp"
 
 const int MIN_NUMBER = 10000, MAX_NUMBER = 99999;
 
+/// Running totals of the Account table, so they needn't be summed up on every query. Changed along with the table,
+/// holding the writer's mutex as well as totalsLocker, so the three are always read together.
+/// The version is seeded with the start time, so versions don't repeat after a restart.
+BankStatistics totals = { 0, 0, (unsigned long long int)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() };
+std::mutex totalsLocker;
+
+void Account::changed(long long int funds, long long int clients)
+{
+	std::lock_guard<std::mutex> lock(totalsLocker);
+	totals.funds += funds;
+	totals.clients += clients;
+	++totals.version;
+}
+
+void Account::recount(DBConnection& writer)
+{
+	BankStatistics counted;
+	writer.statement("select (select * from Balance_Total), (select * from Account_Total)") >> [&](long long int funds, long long int clients)
+	{
+		counted.funds = funds;
+		counted.clients = clients;
+	};
+	std::lock_guard<std::mutex> lock(totalsLocker);
+	totals.funds = counted.funds;
+	totals.clients = counted.clients;
+	++totals.version;
+}
+
+void Account::reconcile()
+{
+	auto singleton = DBSingleton::instance();
+	std::lock_guard<std::mutex> lock(singleton->writer->mutex);
+	recount(*singleton->writer);
+	singleton->rolledBack = recount;
+}
+
 void Account::checkNumber(int number)
 {
 	if (number < MIN_NUMBER || number > MAX_NUMBER)
@@ -11,13 +50,15 @@ void Account::checkNumber(int number)
 		throw InterbanqaException("Account number out of range");
 	}
 }
-bool Account::has(int number)
+void Account::checkExists(int number)
 {
 	auto singleton = DBSingleton::instance();
 	int count;
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "select count(*) from Account where id = ?" << number >> count;
-	return count > 0;
+	singleton->writer->statement("select count(*) from Account where id = ?") << number >> count;
+	if (count == 0)
+	{
+		throw InterbanqaException("Account doesn't exist");
+	}
 }
 
 Account::Account()
@@ -27,48 +68,65 @@ Account::Account()
 Account Account::create()
 {
 	auto singleton = DBSingleton::instance();
-	if (true)
-	{
-		std::lock_guard<std::mutex> lock(singleton->db_mutex);
-		*singleton->db << "insert into Account default values;";
-	}
-	return get(singleton->db->last_insert_rowid());
+	Account res;
+	std::unique_lock<std::mutex> lock = singleton->beginChange();
+	singleton->writer->statement("insert into Account default values;").execute();
+	res._number = singleton->writer->db->last_insert_rowid();
+	res._balance = 0;
+	changed(0, 1);
+	// Not read back, as readers may not see it yet when changes aren't waited for
+	singleton->endChange(lock, res._number);
+	return res;
 }
 void Account::remove(int number)
 {
 	checkNumber(number);
 	auto singleton = DBSingleton::instance();
-	Account ac = get(number);
-	if (ac._balance > 0)
+	bool removed = false;
+	std::unique_lock<std::mutex> lock = singleton->beginChange();
+	singleton->writer->statement("delete from Account where id = ? and balance = 0 returning id;") << number >> [&](int)
+	{
+		removed = true;
+	};
+	if (!removed)
 	{
+		// Only looked into when it fails, to tell why
+		checkExists(number);
 		throw InterbanqaException("Cannot remove account with value");
 	}
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "delete from Account where id = ?;" << number;
+	changed(0, -1);
+	singleton->endChange(lock, number);
 }
 Account Account::get(int number)
 {
 	checkNumber(number);
-	if (!has(number))
-	{
-		throw InterbanqaException("Account doesn't exist");
-	}
 	auto singleton = DBSingleton::instance();
 	Account res;
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "select id, balance from Account where id = ?" << number >> [&](int number, long long int balance)
+	bool found = false;
+	std::unique_lock<std::mutex> lock;
+	DBConnection* connection;
+	if (singleton->uncommitted(number))
+	{
+		// Answered already, but only the writer sees it until it's committed
+		lock = std::unique_lock<std::mutex>(singleton->writer->mutex);
+		connection = singleton->writer.get();
+	}
+	else
+	{
+		connection = &singleton->reader(lock);
+	}
+	connection->statement("select id, balance from Account where id = ?") << number >> [&](int number, long long int balance)
 	{
 		res._number = number;
 		res._balance = balance;
+		found = true;
 	};
+	if (!found)
+	{
+		throw InterbanqaException("Account doesn't exist");
+	}
 	return res;
 }
-void Account::save()
-{
-	auto singleton = DBSingleton::instance();
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "update Account set balance = ? where id = ?" << _balance << _number;
-}
 
 int Account::number()
 {
@@ -79,46 +137,70 @@ long long int Account::balance()
 	return _balance;
 }
 
-void Account::deposit(long long int amount)
+long long int Account::deposit(int number, long long int amount)
 {
+	checkNumber(number);
 	if (amount < 0)
 	{
 		throw InterbanqaException("Amount must not be negative");
 	}
-	_balance += amount;
-	if (_balance < 0)
+	auto singleton = DBSingleton::instance();
+	long long int res;
+	bool updated = false;
+	std::unique_lock<std::mutex> lock = singleton->beginChange();
+	// The bound keeps the sum from overflowing, which SQLite would store as a float instead
+	singleton->writer->statement("update Account set balance = balance + ? where id = ? and balance <= ? returning balance;") << amount << number << std::numeric_limits<long long int>::max() - amount >> [&](long long int balance)
 	{
+		res = balance;
+		updated = true;
+	};
+	if (!updated)
+	{
+		checkExists(number);
 		throw InterbanqaException("Cannot deposit that much");
 	}
-	save();
+	changed(amount, 0);
+	singleton->endChange(lock, number);
+	return res;
 }
-void Account::withdraw(long long int amount)
+long long int Account::withdraw(int number, long long int amount)
 {
+	checkNumber(number);
 	if (amount < 0)
 	{
 		throw InterbanqaException("Amount must not be negative");
 	}
-	_balance -= amount;
-	if (_balance < 0)
+	auto singleton = DBSingleton::instance();
+	long long int res;
+	bool updated = false;
+	std::unique_lock<std::mutex> lock = singleton->beginChange();
+	singleton->writer->statement("update Account set balance = balance - ? where id = ? and balance >= ? returning balance;") << amount << number << amount >> [&](long long int balance)
+	{
+		res = balance;
+		updated = true;
+	};
+	if (!updated)
 	{
+		checkExists(number);
 		throw InterbanqaException("Cannot withdraw that much");
 	}
-	save();
+	changed(-amount, 0);
+	singleton->endChange(lock, number);
+	return res;
 }
 
 long long int Account::count()
 {
-	auto singleton = DBSingleton::instance();
-	long long int res;
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "select * from Account_Total" >> res;
-	return res;
+	std::lock_guard<std::mutex> lock(totalsLocker);
+	return totals.clients;
 }
 long long int Account::funds()
 {
-	auto singleton = DBSingleton::instance();
-	long long int res;
-	std::lock_guard<std::mutex> lock(singleton->db_mutex);
-	*singleton->db << "select * from Balance_Total" >> res;
-	return res;
+	std::lock_guard<std::mutex> lock(totalsLocker);
+	return totals.funds;
+}
+BankStatistics Account::statistics()
+{
+	std::lock_guard<std::mutex> lock(totalsLocker);
+	return totals;
 }
\ No newline at end of file
@@ -1,8 +1,47 @@
 #include "database/singleton.hpp"
 #include <fstream>
+#include <thread>
+#include "config.hpp"
+#include "exception.hpp"
 #include "kritase64.hpp"
+#include "log.hpp"
+#include "stats.hpp"
 
 const char* DB_PATH = "interbanqa.db";
+/// How long a connection waits for a lock it needs, mostly readers while the log is being truncated.
+const int DB_BUSY_TIMEOUT = 5000;
+
+DBConnection::DBConnection(const std::string& path, sqlite::OpenFlags flags)
+{
+	sqlite::sqlite_config config;
+	config.flags = flags;
+	db = std::make_unique<sqlite::database>(path, config);
+	sqlite3_busy_timeout(db->connection().get(), DB_BUSY_TIMEOUT);
+}
+
+DBConnection::~DBConnection()
+{
+	statements.clear();
+}
+
+sqlite::database_binder& DBConnection::statement(const std::string& sql)
+{
+	auto it = statements.find(sql);
+	if (it == statements.end())
+	{
+		it = statements.emplace(sql, std::make_unique<sqlite::database_binder>(*db << sql)).first;
+	}
+	else
+	{
+		it->second->reset();
+	}
+	return *it->second;
+}
+
+void committerThread(DBSingleton* singleton)
+{
+	singleton->commit();
+}
 
 DBSingleton::DBSingleton()
 {
@@ -14,7 +53,50 @@ DBSingleton::DBSingleton()
 		reset();
 	}
 
-	db = std::make_unique<sqlite::database>(DB_PATH);
+	// Each connection is only used by the thread holding its mutex, so SQLite needn't lock it again
+	writer = std::make_unique<DBConnection>(DB_PATH, sqlite::OpenFlags::READWRITE | sqlite::OpenFlags::NOMUTEX);
+	*writer->db << "pragma journal_mode = wal;";
+	*writer->db << "pragma synchronous = " + config::DB_SYNCHRONOUS + ";";
+	*writer->db << "pragma wal_autocheckpoint = " + std::to_string(config::DB_CHECKPOINT) + ";";
+
+	int count = config::DB_READERS;
+	if (count <= 0)
+	{
+		count = std::max(1u, std::thread::hardware_concurrency());
+	}
+	readers.reserve(count);
+	for (int index = 0; index < count; ++index)
+	{
+		readers.emplace_back(std::make_unique<DBConnection>(DB_PATH, sqlite::OpenFlags::READONLY | sqlite::OpenFlags::NOMUTEX));
+	}
+
+	if (config::DB_DURABILITY != "op")
+	{
+		committing = true;
+		committer = std::thread(committerThread, this);
+	}
+}
+
+DBSingleton::~DBSingleton()
+{
+	commitLocker.lock();
+	committing = false;
+	commitLocker.unlock();
+	commitCondition.notify_all();
+	if (committer.joinable())
+	{
+		committer.join();
+	}
+	try
+	{
+		checkpoint();
+	}
+	catch (...)
+	{
+	}
+	// The writer goes last, so closing it cleans up the log
+	readers.clear();
+	writer.reset();
 }
 
 void DBSingleton::reset()
@@ -27,6 +109,174 @@ void DBSingleton::reset()
 	sqlite3_exec(db.connection().get(), SCHEMA.c_str(), nullptr, nullptr, nullptr);
 }
 
+DBConnection& DBSingleton::reader(std::unique_lock<std::mutex>& lock)
+{
+	size_t start = nextReader++;
+	for (size_t offset = 0; offset < readers.size(); ++offset)
+	{
+		DBConnection& connection = *readers[(start + offset) % readers.size()];
+		lock = std::unique_lock<std::mutex>(connection.mutex, std::try_to_lock);
+		if (lock.owns_lock())
+		{
+			return connection;
+		}
+	}
+	// All busy, waits for the one whose turn it is
+	DBConnection& connection = *readers[start % readers.size()];
+	lock = std::unique_lock<std::mutex>(connection.mutex);
+	return connection;
+}
+
+std::unique_lock<std::mutex> DBSingleton::beginChange()
+{
+	if (config::DB_DURABILITY == "async")
+	{
+		// Leaves the writer to the committer once the batch is due, rather than racing it for the mutex. Changes that
+		// wait for their batch make way for it anyway.
+		std::unique_lock<std::mutex> commitLock(commitLocker);
+		commitCondition.wait(commitLock, [this]()
+		{
+			return !due;
+		});
+	}
+	std::unique_lock<std::mutex> lock(writer->mutex);
+	if (config::DB_DURABILITY != "op" && !collecting)
+	{
+		writer->statement("begin;").execute();
+		std::lock_guard<std::mutex> commitLock(commitLocker);
+		collecting = true;
+		commitCondition.notify_all();
+	}
+	return lock;
+}
+
+void DBSingleton::endChange(std::unique_lock<std::mutex>& lock, long long int row)
+{
+	if (config::DB_DURABILITY == "op")
+	{
+		lock.unlock();
+		++stats::DB_COMMITS;
+		++stats::DB_CHANGES;
+		return;
+	}
+	++batchChanges;
+	unsigned long long int mine = batch;
+	if (config::DB_DURABILITY == "async")
+	{
+		std::lock_guard<std::mutex> commitLock(commitLocker);
+		pending.insert(row);
+		lock.unlock();
+		return;
+	}
+	lock.unlock();
+
+	std::unique_lock<std::mutex> commitLock(commitLocker);
+	commitCondition.wait(commitLock, [this, mine]()
+	{
+		return committed >= mine;
+	});
+	auto failure = failed.find(mine);
+	if (failure != failed.end())
+	{
+		// The last change of the batch to find out forgets it
+		if (--failure->second <= 0) failed.erase(failure);
+		throw InterbanqaException("Couldn't save the change");
+	}
+}
+
+bool DBSingleton::uncommitted(long long int row)
+{
+	std::lock_guard<std::mutex> commitLock(commitLocker);
+	return pending.count(row) > 0;
+}
+
+void DBSingleton::commitBatch()
+{
+	if (!collecting)
+	{
+		return;
+	}
+	bool succeeded = true;
+	try
+	{
+		writer->statement("commit;").execute();
+	}
+	catch (const std::exception& e)
+	{
+		succeeded = false;
+		runtime_log.log("Couldn't commit a batch of " + std::to_string(batchChanges) + " changes, they're lost: " + e.what(), LOG_ERROR);
+		try
+		{
+			writer->statement("rollback;").execute();
+		}
+		catch (const std::exception& e)
+		{
+		}
+		if (rolledBack) rolledBack(*writer);
+	}
+	std::lock_guard<std::mutex> commitLock(commitLocker);
+	if (succeeded)
+	{
+		++stats::DB_COMMITS;
+		stats::DB_CHANGES += batchChanges;
+	}
+	else
+	{
+		++stats::DB_COMMIT_FAILURES;
+		// Only "group" changes wait to be told, "async" ones were answered already
+		if (config::DB_DURABILITY == "group" && batchChanges > 0) failed[batch] = batchChanges;
+	}
+	pending.clear();
+	collecting = false;
+	committed = batch;
+	++batch;
+	batchChanges = 0;
+	commitCondition.notify_all();
+}
+
+void DBSingleton::commit()
+{
+	std::unique_lock<std::mutex> commitLock(commitLocker);
+	while (true)
+	{
+		commitCondition.wait(commitLock, [this]()
+		{
+			return collecting || !committing;
+		});
+		if (!collecting && !committing)
+		{
+			return;
+		}
+		// Lets the batch fill up for a while, but stops waiting when the node does
+		commitCondition.wait_for(commitLock, std::chrono::milliseconds(config::DB_COMMIT_WINDOW), [this]()
+		{
+			return !committing;
+		});
+		due = true;
+		commitLock.unlock();
+		std::unique_lock<std::mutex> lock(writer->mutex);
+		commitBatch();
+		lock.unlock();
+		commitLock.lock();
+		due = false;
+		commitCondition.notify_all();
+	}
+}
+
+std::string DBSingleton::checkpoint()
+{
+	std::lock_guard<std::mutex> lock(writer->mutex);
+	// The log can't be truncated from inside a transaction
+	commitBatch();
+	std::string res;
+	*writer->db << "pragma wal_checkpoint(truncate);" >> [&](int busy, int logged, int copied)
+	{
+		if (busy) res = "Checkpoint blocked, " + std::to_string(copied) + " of " + std::to_string(logged) + " pages copied";
+		else res = "Checkpoint done, log truncated";
+	};
+	return res;
+}
+
 std::shared_ptr<DBSingleton> DBSingleton::_instance;
 
 std::shared_ptr<DBSingleton> DBSingleton::instance()
@@ -0,0 +1,250 @@
+#include "discovery.hpp"
+#include <future>
+#include "circuitbreaker.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "networking/reactor.hpp"
+#include "portdirectory.hpp"
+#include "stats.hpp"
+#include "stringops.hpp"
+
+const char DISCOVERY_QUERY[] = "DQ";
+const char DISCOVERY_ANNOUNCE[] = "DA";
+const char DISCOVERY_LEAVE[] = "DL";
+/// How long after asking the group the answers are expected to be in.
+const std::chrono::milliseconds DISCOVERY_WINDOW(500);
+/// Announcements a bank may miss before it's forgotten.
+const int DISCOVERY_MISSED_ANNOUNCEMENTS = 3;
+
+std::string discoveryKey(const std::string& address, int port)
+{
+	return address + ":" + std::to_string(port);
+}
+
+Discovery::Discovery() : strand(boost::asio::make_strand(Reactor::instance()->context())), socket(strand), timer(strand)
+{
+}
+
+Discovery::~Discovery()
+{
+	stop();
+}
+
+void Discovery::start()
+{
+	std::lock_guard<std::mutex> lock(discoveryLocker);
+	if (running || !config::DISCOVERY)
+	{
+		return;
+	}
+	try
+	{
+		boost::asio::ip::address_v4 groupAddress = boost::asio::ip::make_address_v4(config::DISCOVERY_GROUP);
+		boost::asio::ip::address_v4 interface = boost::asio::ip::make_address_v4(config::ADDRESS);
+		group = boost::asio::ip::udp::endpoint(groupAddress, config::DISCOVERY_PORT);
+		socket.open(boost::asio::ip::udp::v4());
+		// Every node on the host listens on the same port
+		socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+		socket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::any(), config::DISCOVERY_PORT));
+		if (groupAddress.is_multicast())
+		{
+			socket.set_option(boost::asio::ip::multicast::join_group(groupAddress, interface));
+			socket.set_option(boost::asio::ip::multicast::outbound_interface(interface));
+			socket.set_option(boost::asio::ip::multicast::enable_loopback(true));
+		}
+		else
+		{
+			socket.set_option(boost::asio::socket_base::broadcast(true));
+		}
+	}
+	catch (const std::exception& e)
+	{
+		runtime_log.log((std::string)"Discovery unavailable, looking for banks by connecting instead: " + e.what(), LOG_WARNING);
+		boost::system::error_code ignored;
+		socket.close(ignored);
+		return;
+	}
+	running = true;
+	queried = std::chrono::steady_clock::now();
+	runtime_log.log("Discovering banks through " + config::DISCOVERY_GROUP + ", port " + std::to_string(config::DISCOVERY_PORT), LOG_INFO);
+
+	boost::asio::post(strand, [this]()
+	{
+		receive();
+		send(DISCOVERY_QUERY);
+		tick();
+	});
+}
+
+void Discovery::stop()
+{
+	discoveryLocker.lock();
+	bool wasRunning = running;
+	running = false;
+	discoveryLocker.unlock();
+	if (!wasRunning)
+	{
+		return;
+	}
+
+	std::shared_ptr<std::promise<void>> closed = std::make_shared<std::promise<void>>();
+	boost::asio::post(strand, [this, closed]()
+	{
+		send((std::string)DISCOVERY_LEAVE + " " + config::ADDRESS + " " + std::to_string(config::PORT));
+		boost::system::error_code ignored;
+		timer.cancel(ignored);
+		socket.close(ignored);
+		closed->set_value();
+	});
+	closed->get_future().wait_for(DISCOVERY_WINDOW);
+}
+
+void Discovery::send(const std::string& message)
+{
+	boost::system::error_code error;
+	socket.send_to(boost::asio::buffer(message), group, 0, error);
+	if (error)
+	{
+		runtime_log.log("Couldn't send '" + message + "' for discovery: " + error.message(), LOG_WARNING);
+	}
+}
+
+void Discovery::receive()
+{
+	socket.async_receive_from(boost::asio::buffer(datagram), sender, [this](const boost::system::error_code& error, size_t size)
+	{
+		if (error == boost::asio::error::operation_aborted || !socket.is_open())
+		{
+			return;
+		}
+		if (!error)
+		{
+			handle(std::string(datagram, size));
+		}
+		receive();
+	});
+}
+
+void Discovery::handle(const std::string& message)
+{
+	std::vector<std::string> arguments = parseCommand(message);
+	if (arguments.empty())
+	{
+		return;
+	}
+	if (arguments[0] == DISCOVERY_QUERY)
+	{
+		send((std::string)DISCOVERY_ANNOUNCE + " " + config::ADDRESS + " " + std::to_string(config::PORT));
+		return;
+	}
+	if ((arguments[0] != DISCOVERY_ANNOUNCE && arguments[0] != DISCOVERY_LEAVE) || arguments.size() < 3)
+	{
+		return;
+	}
+
+	boost::system::error_code error;
+	boost::asio::ip::address_v4 address = boost::asio::ip::make_address_v4(arguments[1], error);
+	int port = 0;
+	try
+	{
+		port = std::stoi(arguments[2]);
+	}
+	catch (const std::exception& e)
+	{
+		return;
+	}
+	if (error || port <= 0 || port > 65535)
+	{
+		return;
+	}
+	std::string key = discoveryKey(address.to_string(), port);
+
+	discoveryLocker.lock();
+	if (key == discoveryKey(config::ADDRESS, config::PORT))
+	{
+		discoveryLocker.unlock();
+		return;
+	}
+	heard = true;
+	bool leaving = arguments[0] == DISCOVERY_LEAVE;
+	bool known = announced.count(key);
+	if (leaving) announced.erase(key);
+	else announced[key] = std::chrono::steady_clock::now();
+	stats::DISCOVERY_BANKS = announced.size();
+	discoveryLocker.unlock();
+
+	if (leaving)
+	{
+		if (known) runtime_log.log("Bank " + key + " left", LOG_INFO);
+		PortDirectory::instance()->forget(address.to_string(), port);
+	}
+	else
+	{
+		if (!known) runtime_log.log("Discovered bank " + key, LOG_INFO);
+		PortDirectory::instance()->learn(address.to_string(), port);
+		CircuitBreaker::instance()->succeeded(address.to_string());
+		++stats::DISCOVERY_ANNOUNCEMENTS;
+	}
+}
+
+void Discovery::tick()
+{
+	send((std::string)DISCOVERY_ANNOUNCE + " " + config::ADDRESS + " " + std::to_string(config::PORT));
+
+	discoveryLocker.lock();
+	auto expired = std::chrono::steady_clock::now() - DISCOVERY_MISSED_ANNOUNCEMENTS * std::chrono::seconds(config::DISCOVERY_INTERVAL);
+	for (auto it = announced.begin(); it != announced.end();)
+	{
+		if (it->second <= expired)
+		{
+			runtime_log.log("Forgetting bank " + it->first + ", it stopped announcing itself", LOG_INFO);
+			it = announced.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	stats::DISCOVERY_BANKS = announced.size();
+	discoveryLocker.unlock();
+
+	timer.expires_after(std::chrono::seconds(config::DISCOVERY_INTERVAL));
+	timer.async_wait([this](const boost::system::error_code& error)
+	{
+		if (!error) tick();
+	});
+}
+
+bool Discovery::ready()
+{
+	std::lock_guard<std::mutex> lock(discoveryLocker);
+	return running && heard && std::chrono::steady_clock::now() - queried >= DISCOVERY_WINDOW;
+}
+
+std::vector<std::pair<std::string, int>> Discovery::peers()
+{
+	std::vector<std::pair<std::string, int>> res;
+	std::string self = discoveryKey(config::ADDRESS, config::PORT);
+	discoveryLocker.lock();
+	for (auto& bank : announced)
+	{
+		std::vector<std::string> parts = splitString(bank.first, ":");
+		res.emplace_back(parts[0], std::stoi(parts[1]));
+	}
+	for (auto& seed : config::SEEDS)
+	{
+		if (seed == self || announced.count(seed)) continue;
+		std::vector<std::string> parts = splitString(seed, ":");
+		res.emplace_back(parts[0], std::stoi(parts[1]));
+	}
+	discoveryLocker.unlock();
+	return res;
+}
+
+std::shared_ptr<Discovery> Discovery::_instance;
+
+std::shared_ptr<Discovery> Discovery::instance()
+{
+	if (_instance == nullptr) _instance.reset(new Discovery);
+	return _instance;
+}
@@ -0,0 +1,344 @@
+#include "gossip.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include "config.hpp"
+#include "database/account.hpp"
+#include "discovery.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "networking/peerpool.hpp"
+#include "portdirectory.hpp"
+#include "stats.hpp"
+#include "stringops.hpp"
+#include "boost/asio.hpp"
+
+/// Intervals between rounds vary by up to this fraction, so nodes started together don't gossip in lockstep.
+const double GOSSIP_JITTER = 0.2;
+/// Rounds without news after which a bank is forgotten. Its tombstone is kept as long again.
+const int GOSSIP_EXPIRY_ROUNDS = 20;
+/// Entries per digest, keeping the GS line well below the maximum line length. Larger networks are sent in turns.
+const size_t MAX_GOSSIP_ENTRIES = 512;
+/// How long a peer that doesn't gossip isn't asked again.
+const std::chrono::seconds GOSSIP_REFUSAL_RETRY(60);
+
+void gossipThread(Gossip* gossip)
+{
+	gossip->gossip();
+}
+
+/**
+ * @return One digest entry: "address:port:funds:clients:version:heartbeat".
+ */
+std::string encodeEntry(const std::string& address, int port, long long int balance, long long int clients, unsigned long long int version, unsigned long long int heartbeat)
+{
+	return address + ":" + std::to_string(port) + ":" + std::to_string(balance) + ":" + std::to_string(clients) + ":" + std::to_string(version) + ":" + std::to_string(heartbeat);
+}
+
+/**
+ * The digest exchanges of a round, answered on the Reactor.
+ */
+struct Exchanges
+{
+	std::mutex locker;
+	std::condition_variable condition;
+	std::vector<std::string> answers;
+	std::vector<std::exception_ptr> failures;
+	std::vector<bool> done;
+	size_t finished = 0;
+};
+
+Gossip::Gossip() : random(std::random_device()())
+{
+}
+
+Gossip::~Gossip()
+{
+	stop();
+}
+
+void Gossip::start()
+{
+	std::lock_guard<std::mutex> lock(gossipLocker);
+	if (running || !config::GOSSIP)
+	{
+		return;
+	}
+	running = true;
+	gossiping = CancellationToken();
+	gossiper = std::thread(gossipThread, this);
+}
+
+void Gossip::stop()
+{
+	gossipLocker.lock();
+	running = false;
+	gossipLocker.unlock();
+	gossiping.cancel();
+	gossipCondition.notify_all();
+	if (gossiper.joinable())
+	{
+		gossiper.join();
+	}
+}
+
+void Gossip::gossip()
+{
+	std::uniform_real_distribution<double> jitter(1 - GOSSIP_JITTER, 1 + GOSSIP_JITTER);
+	while (true)
+	{
+		try
+		{
+			round();
+		}
+		catch (const std::exception& e)
+		{
+			runtime_log.log((std::string)"Gossip round failed: " + e.what(), LOG_WARNING);
+		}
+
+		std::unique_lock<std::mutex> lock(gossipLocker);
+		auto pause = std::chrono::milliseconds((long long int)(config::GOSSIP_INTERVAL * jitter(random)));
+		gossipCondition.wait_for(lock, pause, [this]()
+		{
+			return !running;
+		});
+		if (!running)
+		{
+			return;
+		}
+	}
+}
+
+void Gossip::round()
+{
+	std::vector<std::pair<std::string, int>> discovered = Discovery::instance()->peers();
+	std::vector<std::pair<std::string, int>> peers;
+	auto now = std::chrono::steady_clock::now();
+	gossipLocker.lock();
+	expire();
+	for (auto& entry : entries)
+	{
+		peers.emplace_back(entry.second.bank.address, entry.second.port);
+	}
+	for (auto& peer : discovered)
+	{
+		std::string key = peer.first + ":" + std::to_string(peer.second);
+		if (entries.count(key)) continue;
+		auto refusal = refused.find(key);
+		if (refusal != refused.end())
+		{
+			if (refusal->second > now) continue;
+			refused.erase(refusal);
+		}
+		peers.emplace_back(peer);
+	}
+	std::shuffle(peers.begin(), peers.end(), random);
+	if (peers.size() > (size_t)config::GOSSIP_FANOUT)
+	{
+		peers.resize(config::GOSSIP_FANOUT);
+	}
+	CancellationToken token(gossiping, std::chrono::steady_clock::now() + std::chrono::milliseconds((int)(1000 * config::TIMEOUT)));
+	gossipLocker.unlock();
+
+	if (peers.empty())
+	{
+		return;
+	}
+	std::string request = digest();
+	std::shared_ptr<Exchanges> exchanges = std::make_shared<Exchanges>();
+	exchanges->answers.resize(peers.size());
+	exchanges->failures.resize(peers.size());
+	exchanges->done.resize(peers.size(), false);
+	for (size_t index = 0; index < peers.size(); ++index)
+	{
+		PeerPool::instance()->requestAsync(peers[index].first, peers[index].second, request, token, [exchanges, index](std::exception_ptr failure, const Packet& answer)
+		{
+			std::lock_guard<std::mutex> lock(exchanges->locker);
+			exchanges->answers[index] = answer.data();
+			exchanges->failures[index] = failure;
+			exchanges->done[index] = true;
+			++exchanges->finished;
+			exchanges->condition.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> lock(exchanges->locker);
+	exchanges->condition.wait_until(lock, token.deadline(), [&exchanges, &peers]()
+	{
+		return exchanges->finished >= peers.size();
+	});
+	std::vector<std::string> answers = exchanges->answers;
+	std::vector<std::exception_ptr> failures = exchanges->failures;
+	std::vector<bool> done = exchanges->done;
+	lock.unlock();
+	// Closes the connections of the exchanges still running, rather than waiting for them
+	token.cancel();
+
+	for (size_t index = 0; index < peers.size(); ++index)
+	{
+		try
+		{
+			if (failures[index]) std::rethrow_exception(failures[index]);
+			if (!done[index])
+			{
+				throw InterbanqaException("Timed out");
+			}
+			std::vector<std::string> answer = parseCommand(answers[index]);
+			if (answer.empty() || answer[0] != "GS")
+			{
+				gossipLocker.lock();
+				refused[peers[index].first + ":" + std::to_string(peers[index].second)] = std::chrono::steady_clock::now() + GOSSIP_REFUSAL_RETRY;
+				gossipLocker.unlock();
+				throw InterbanqaException("Doesn't gossip");
+			}
+			merge(answer);
+			PortDirectory::instance()->learn(peers[index].first, peers[index].second);
+			gossipLocker.lock();
+			heard = true;
+			gossipLocker.unlock();
+			++stats::GOSSIP_EXCHANGES;
+		}
+		catch (const std::exception& e)
+		{
+			runtime_log.log("Couldn't gossip with " + peers[index].first + ", port " + std::to_string(peers[index].second) + ": " + e.what(), LOG_INFO);
+			++stats::GOSSIP_FAILURES;
+		}
+	}
+	++stats::GOSSIP_ROUNDS;
+}
+
+void Gossip::expire()
+{
+	auto now = std::chrono::steady_clock::now();
+	auto expiry = std::chrono::milliseconds((long long int)config::GOSSIP_INTERVAL * GOSSIP_EXPIRY_ROUNDS);
+	for (auto it = forgotten.begin(); it != forgotten.end();)
+	{
+		if (now - it->second.updated > expiry) it = forgotten.erase(it);
+		else ++it;
+	}
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		if (now - it->second.updated > expiry)
+		{
+			runtime_log.log("Forgetting bank " + it->first + ", not heard of in a while", LOG_INFO);
+			it->second.updated = now;
+			forgotten[it->first] = it->second;
+			it = entries.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	stats::GOSSIP_BANKS = entries.size();
+}
+
+std::string Gossip::digest()
+{
+	BankStatistics statistics = Account::statistics();
+	unsigned long long int now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::lock_guard<std::mutex> lock(gossipLocker);
+	heartbeat = std::max(heartbeat + 1, now);
+	std::string res = "GS " + encodeEntry(config::ADDRESS, config::PORT, statistics.funds, statistics.clients, statistics.version, heartbeat);
+	if (entries.empty())
+	{
+		return res;
+	}
+	// Starts somewhere else every time, so all the banks get their turn if they don't fit
+	auto start = entries.begin();
+	if (entries.size() >= MAX_GOSSIP_ENTRIES)
+	{
+		std::advance(start, std::uniform_int_distribution<size_t>(0, entries.size() - 1)(random));
+	}
+	auto it = start;
+	size_t count = 1;
+	do
+	{
+		const Entry& entry = it->second;
+		res += " " + encodeEntry(entry.bank.address, entry.port, entry.bank.balance, entry.bank.clients, entry.bank.version, entry.heartbeat);
+		++count;
+		if (++it == entries.end()) it = entries.begin();
+	}
+	while (it != start && count < MAX_GOSSIP_ENTRIES);
+	return res;
+}
+
+void Gossip::merge(const std::vector<std::string>& arguments)
+{
+	std::string self = config::ADDRESS + ":" + std::to_string(config::PORT);
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(gossipLocker);
+	for (size_t index = 1; index < arguments.size(); ++index)
+	{
+		std::vector<std::string> fields = splitString(arguments[index], ":");
+		if (fields.size() != 6)
+		{
+			continue;
+		}
+		Entry entry;
+		try
+		{
+			boost::system::error_code error;
+			boost::asio::ip::address_v4 address = boost::asio::ip::make_address_v4(fields[0], error);
+			entry.port = std::stoi(fields[1]);
+			if (error || entry.port <= 0 || entry.port > 65535)
+			{
+				continue;
+			}
+			entry.bank.address = address.to_string();
+			entry.bank.balance = std::stoll(fields[2]);
+			entry.bank.clients = std::stoi(fields[3]);
+			entry.bank.version = std::stoull(fields[4]);
+			entry.heartbeat = std::stoull(fields[5]);
+		}
+		catch (const std::exception& e)
+		{
+			continue;
+		}
+		std::string key = entry.bank.address + ":" + std::to_string(entry.port);
+		if (key == self)
+		{
+			continue;
+		}
+		auto gone = forgotten.find(key);
+		if (gone != forgotten.end())
+		{
+			if (gone->second.heartbeat >= entry.heartbeat) continue;
+			// Back again
+			forgotten.erase(gone);
+		}
+		auto known = entries.find(key);
+		if (known != entries.end() && known->second.heartbeat >= entry.heartbeat)
+		{
+			continue;
+		}
+		entry.updated = now;
+		entries[key] = entry;
+	}
+	stats::GOSSIP_BANKS = entries.size();
+}
+
+bool Gossip::ready()
+{
+	std::lock_guard<std::mutex> lock(gossipLocker);
+	return heard;
+}
+
+std::vector<Bank> Gossip::banks()
+{
+	std::vector<Bank> res;
+	std::lock_guard<std::mutex> lock(gossipLocker);
+	res.reserve(entries.size());
+	for (auto& entry : entries)
+	{
+		res.emplace_back(entry.second.bank);
+	}
+	return res;
+}
+
+std::shared_ptr<Gossip> Gossip::_instance;
+
+std::shared_ptr<Gossip> Gossip::instance()
+{
+	if (_instance == nullptr) _instance.reset(new Gossip);
+	return _instance;
+}
@@ -1,10 +1,11 @@
+#include "database/account.hpp"
 #include "database/singleton.hpp"
 #include "log.hpp"
 #include "server.hpp"
 #include "config.hpp"
 #include <string>
 
-int main(int argc, char* argv[])
+int main()
 {
 	runtime_log.start("runtime.log");
 	runtime_log.log("Initializing Interbanqa", LOG_INFO);
@@ -13,6 +14,7 @@ int main(int argc, char* argv[])
 		initConfig();
 
 		DBSingleton::instance();
+		Account::reconcile();
 
 		Server server;
 		server.start();
@@ -28,16 +28,16 @@
  */
 
 #include "networking/acceptor.hpp"
-#include <thread>
+#include "config.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "networking/reactor.hpp"
+#include "stats.hpp"
 
-void acceptorThread(Acceptor* acceptor)
+Acceptor::Acceptor(bool dispatchClients) : acceptor(Reactor::instance()->context())
 {
-	acceptor->hostThread();
-}
-
-Acceptor::Acceptor() : acceptor(ioContext)
-{
-
+	this->dispatchClients = dispatchClients;
+	incomingPackets = std::make_shared<RingQueue<Packet>>(config::QUEUE_DEPTH);
 }
 
 Acceptor::~Acceptor()
@@ -49,19 +49,19 @@ void Acceptor::close()
 {
 	accepting = false;
 	internalLocker.lock();
-	acceptor.close();
+	boost::system::error_code ignored;
+	acceptor.close(ignored);
 	internalLocker.unlock();
 	acceptorLocker.lock();
-	for (auto& s : sockets)
-	{
-		if (s != nullptr) s->close();
-	}
+	std::unordered_map<Socket*, std::shared_ptr<Socket>> closing;
+	closing.swap(sockets);
+	stats::CONNECTIONS_OPEN -= closing.size();
+	connectionsPerAddress.clear();
 	acceptorLocker.unlock();
-	if (acceptorThread.joinable())
+	for (auto& s : closing)
 	{
-		acceptorThread.join();
+		s.second->close();
 	}
-	sockets.clear();
 	_port = 0;
 }
 
@@ -70,78 +70,149 @@ int Acceptor::port() const
 	return _port;
 }
 
-void Acceptor::update()
+void Acceptor::stalled(std::shared_ptr<Socket> socket)
+{
+	stalledLocker.lock();
+	stalledSockets.emplace_back(socket);
+	++stalledCount;
+	stalledLocker.unlock();
+}
+
+void Acceptor::closed(Socket* socket)
 {
 	acceptorLocker.lock();
-	for (auto it = sockets.begin(); it != sockets.end();)
+	auto it = sockets.find(socket);
+	if (it == sockets.end())
 	{
-		std::shared_ptr<Socket> s = *it;
-		if (s->isOpen())
-		{
-			while (s->pending() > 0)
-			{
-				incomingPackets.emplace_back(s->next());
-			}
-
-			++it;
-		}
-		else
-		{
-			it = sockets.erase(it);
-		}
+		acceptorLocker.unlock();
+		return;
+	}
+	std::shared_ptr<Socket> released = it->second;
+	sockets.erase(it);
+	--stats::CONNECTIONS_OPEN;
+	auto count = connectionsPerAddress.find(socket->address());
+	if (count != connectionsPerAddress.end() && --count->second <= 0)
+	{
+		connectionsPerAddress.erase(count);
 	}
 	acceptorLocker.unlock();
 }
 
 size_t Acceptor::pending()
 {
-	update();
-	size_t res = incomingPackets.size();
-	return res;
+	return incomingPackets->size();
 }
 Packet Acceptor::next()
 {
-	update();
-	Packet res = incomingPackets[0];
-	incomingPackets.erase(incomingPackets.begin());
+	Packet res;
+	if (!incomingPackets->pop(res))
+	{
+		throw InterbanqaException("No pending packets");
+	}
+	if (stalledCount > 0)
+	{
+		stalledLocker.lock();
+		std::vector<std::weak_ptr<Socket>> resumed;
+		resumed.swap(stalledSockets);
+		stalledCount = 0;
+		stalledLocker.unlock();
+		for (auto& s : resumed)
+		{
+			std::shared_ptr<Socket> socket = s.lock();
+			if (socket != nullptr) socket->resume();
+		}
+	}
 	return res;
 }
 
-void Acceptor::hostThread()
+void Acceptor::accept()
 {
-	while (accepting)
+	internalLocker.lock();
+	if (accepting && acceptor.is_open())
 	{
 		acceptedSocket.reset(new Socket());
-		try
+		std::shared_ptr<Acceptor> self = shared_from_this();
+		acceptor.async_accept(*acceptedSocket->raw(), [self](const boost::system::error_code& error)
+		{
+			self->accepted(error);
+		});
+	}
+	internalLocker.unlock();
+}
+
+void Acceptor::accepted(const boost::system::error_code& error)
+{
+	if (error == boost::asio::error::operation_aborted || !accepting)
+	{
+		return;
+	}
+	if (error)
+	{
+		runtime_log.log("Failed to accept connection: " + error.message(), LOG_WARNING);
+	}
+	else
+	{
+		internalLocker.lock();
+		std::shared_ptr<Socket> socket = acceptedSocket;
+		internalLocker.unlock();
+
+		boost::system::error_code endpointError;
+		std::string address = socket->raw()->remote_endpoint(endpointError).address().to_string();
+
+		acceptorLocker.lock();
+		bool admitted = (int)sockets.size() < config::MAX_CONNECTIONS && connectionsPerAddress[address] < config::MAX_CONNECTIONS_PER_IP;
+		if (admitted)
+		{
+			sockets[socket.get()] = socket;
+			++connectionsPerAddress[address];
+			++stats::CONNECTIONS_OPEN;
+			++stats::CONNECTIONS_ACCEPTED;
+		}
+		else if (connectionsPerAddress[address] <= 0)
+		{
+			connectionsPerAddress.erase(address);
+		}
+		acceptorLocker.unlock();
+
+		if (!admitted)
 		{
-			if (acceptor.is_open())
-			{
-				internalLocker.lock();
-				try
-				{
-					acceptedSocket->accept(acceptor);
-				}
-				catch (...)
-				{
-					internalLocker.unlock();
-					throw;
-				}
-				internalLocker.unlock();
-				acceptorLocker.lock();
-				sockets.emplace_back(acceptedSocket);
-				acceptorLocker.unlock();
-			}
-			else
-			{
-				accepting = false;
-			}
+			++stats::CONNECTIONS_SHED;
+			runtime_log.log("Rejecting connection from " + address + ": too many connections", LOG_WARNING);
+			socket->reject("ER busy\r\n");
+			accept();
+			return;
 		}
-		catch (const boost::wrapexcept<boost::system::system_error>& error)
+
+		socket->own(shared_from_this());
+		if (dispatchClients)
 		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			// Silently ignore
+			socket->start(true);
 		}
+		else
+		{
+			socket->start(incomingPackets);
+		}
+	}
+	accept();
+}
+
+void Acceptor::listen(const boost::asio::ip::tcp::endpoint& endpoint)
+{
+	internalLocker.lock();
+	try
+	{
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+		acceptor.bind(endpoint);
+		acceptor.listen();
 	}
+	catch (...)
+	{
+		internalLocker.unlock();
+		throw;
+	}
+	internalLocker.unlock();
+	accept();
 }
 
 void Acceptor::hostV4(int port)
@@ -149,37 +220,19 @@ void Acceptor::hostV4(int port)
 	close();
 	_port = port;
 	accepting = true;
-	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), _port);
-	acceptor.open(endpoint.protocol());
-	acceptor.set_option(boost::asio::socket_base::reuse_address(true));
-	acceptor.bind(endpoint);
-	acceptor.listen();
-	acceptor.non_blocking(true);
-	acceptorThread = std::thread(::acceptorThread, this);
+	listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), _port));
 }
 void Acceptor::hostV6(int port)
 {
 	close();
 	_port = port;
 	accepting = true;
-	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v6(), _port);
-	acceptor.open(endpoint.protocol());
-	acceptor.set_option(boost::asio::socket_base::reuse_address(true));
-	acceptor.bind(endpoint);
-	acceptor.listen();
-	acceptor.non_blocking(true);
-	acceptorThread = std::thread(::acceptorThread, this);
+	listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), _port));
 }
 void Acceptor::host(const std::string& address, int port)
 {
 	close();
 	_port = port;
 	accepting = true;
-	boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address(address), _port);
-	acceptor.open(endpoint.protocol());
-	acceptor.set_option(boost::asio::socket_base::reuse_address(true));
-	acceptor.bind(endpoint);
-	acceptor.listen();
-	acceptor.non_blocking(true);
-	acceptorThread = std::thread(::acceptorThread, this);
+	listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(address), _port));
 }
\ No newline at end of file
@@ -75,6 +75,15 @@ Packet Connection::next()
 	throw InterbanqaException("error");
 }
 
+bool Connection::wait(const CancellationToken& token)
+{
+	if (socket != nullptr)
+	{
+		return socket->wait(token);
+	}
+	return pending() > 0;
+}
+
 void Connection::hostV4(int port)
 {
 	close();
@@ -93,17 +102,17 @@ void Connection::host(const std::string& address, int port)
 	acceptor.reset(new Acceptor);
 	acceptor->host(address, port);
 }
-void Connection::connectV4(std::string ip, std::string port)
+void Connection::connectV4(std::string ip, std::string port, const CancellationToken& token)
 {
 	close();
 	socket.reset(new Socket);
-	socket->connectV4(ip, port);
+	socket->connectV4(ip, port, token);
 }
-void Connection::connectV6(std::string ip, std::string port)
+void Connection::connectV6(std::string ip, std::string port, const CancellationToken& token)
 {
 	close();
 	socket.reset(new Socket);
-	socket->connectV6(ip, port);
+	socket->connectV6(ip, port, token);
 }
 
 void Connection::send(Buffer buffer, std::shared_ptr<boost::asio::ip::tcp::socket> socket)
@@ -29,6 +29,9 @@
 
 #include "networking/packet.hpp"
 
+Packet::Packet()
+{
+}
 Packet::Packet(const void* data, size_t size, std::shared_ptr<boost::asio::ip::tcp::socket> socket)
 {
 	packetData.assign((char*)data, size);
@@ -47,4 +50,13 @@ Buffer Packet::data() const
 std::shared_ptr<boost::asio::ip::tcp::socket> Packet::socket() const
 {
 	return _socket;
+}
+
+bool Packet::shed() const
+{
+	return _shed;
+}
+void Packet::shed(bool shed)
+{
+	_shed = shed;
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "networking/peerlink.hpp"
+#include <vector>
+#include "config.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "stringops.hpp"
+
+/// Negotiates request IDs, see Client.
+const char MULTIPLEX_COMMAND[] = "XM";
+
+PeerLink::PeerLink(std::shared_ptr<Socket> socket)
+{
+	this->socket = socket;
+	lastUsed = std::chrono::steady_clock::now();
+}
+
+PeerLink::~PeerLink()
+{
+	close();
+}
+
+bool PeerLink::negotiate(std::shared_ptr<Socket> socket, const CancellationToken& token)
+{
+	socket->send((std::string)MULTIPLEX_COMMAND + "\r\n");
+	if (!socket->wait(token))
+	{
+		throw InterbanqaException("No response from " + socket->address());
+	}
+	std::vector<std::string> response = parseCommand(socket->next().data());
+	return response.size() > 0 && response[0] == MULTIPLEX_COMMAND;
+}
+
+void PeerLink::start()
+{
+	std::weak_ptr<PeerLink> weakSelf = shared_from_this();
+	socket->listen([weakSelf]()
+	{
+		std::shared_ptr<PeerLink> self = weakSelf.lock();
+		if (self != nullptr)
+		{
+			self->received();
+		}
+	});
+	// The socket may have closed before it had a listener
+	if (!socket->isOpen())
+	{
+		received();
+	}
+}
+
+void PeerLink::received()
+{
+	std::vector<Packet> packets;
+	while (socket->next(packets, config::QUEUE_DEPTH) > 0)
+	{
+		std::lock_guard<std::mutex> lock(linkLocker);
+		for (auto& packet : packets)
+		{
+			const std::string& data = packet.data();
+			size_t separator = data.find(' ');
+			if (data.empty() || data[0] != '#' || separator == std::string::npos)
+			{
+				runtime_log.log("Ignoring untagged response '" + data + "' from " + socket->address(), LOG_WARNING);
+				continue;
+			}
+			unsigned long long int id;
+			try
+			{
+				id = std::stoull(data.substr(1, separator - 1));
+			}
+			catch (const std::exception& e)
+			{
+				runtime_log.log("Ignoring response with invalid ID '" + data + "' from " + socket->address(), LOG_WARNING);
+				continue;
+			}
+			auto it = calls.find(id);
+			if (it == calls.end())
+			{
+				// Its request gave up waiting already
+				continue;
+			}
+			it->second->response = Packet(data.substr(separator + 1), socket->raw());
+			it->second->done = true;
+			calls.erase(it);
+		}
+		packets.clear();
+	}
+
+	linkLocker.lock();
+	if (!socket->isOpen())
+	{
+		broken = true;
+	}
+	linkLocker.unlock();
+	linkCondition.notify_all();
+}
+
+Packet PeerLink::request(const std::string& line, const CancellationToken& token, bool& sent)
+{
+	sent = false;
+	std::shared_ptr<Call> call = std::make_shared<Call>();
+	std::unique_lock<std::mutex> lock(linkLocker);
+	if (broken)
+	{
+		throw InterbanqaException("Connection closed");
+	}
+	unsigned long long int id = nextId++;
+	calls[id] = call;
+	lastUsed = std::chrono::steady_clock::now();
+	lock.unlock();
+
+	try
+	{
+		socket->send("#" + std::to_string(id) + " " + line + "\r\n");
+		sent = true;
+	}
+	catch (const InterbanqaException& e)
+	{
+		lock.lock();
+		calls.erase(id);
+		throw;
+	}
+
+	std::weak_ptr<PeerLink> weakSelf = shared_from_this();
+	CancellationSubscription subscription(token, [weakSelf]()
+	{
+		std::shared_ptr<PeerLink> self = weakSelf.lock();
+		if (self != nullptr)
+		{
+			self->linkLocker.lock();
+			self->linkLocker.unlock();
+			self->linkCondition.notify_all();
+		}
+	});
+	lock.lock();
+	linkCondition.wait_until(lock, token.deadline(), [this, &call, &token]()
+	{
+		return call->done || broken || token.cancelled();
+	});
+	calls.erase(id);
+	lastUsed = std::chrono::steady_clock::now();
+	if (!call->done)
+	{
+		throw InterbanqaException("No response from " + socket->address());
+	}
+	return call->response;
+}
+
+bool PeerLink::isOpen()
+{
+	std::lock_guard<std::mutex> lock(linkLocker);
+	return !broken && socket->isOpen();
+}
+
+bool PeerLink::idleSince(std::chrono::steady_clock::time_point time)
+{
+	std::lock_guard<std::mutex> lock(linkLocker);
+	return calls.empty() && lastUsed <= time;
+}
+
+void PeerLink::close()
+{
+	socket->close();
+	linkLocker.lock();
+	broken = true;
+	linkLocker.unlock();
+	linkCondition.notify_all();
+}
@@ -0,0 +1,547 @@
+#include "networking/peerpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+#include "config.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "networking/reactor.hpp"
+#include "stats.hpp"
+
+/// How often idle connections are checked for eviction.
+const std::chrono::seconds EVICTION_INTERVAL(1);
+/// How long a peer that refused request IDs isn't asked again.
+const std::chrono::seconds PLAIN_PEER_RETRY(60);
+/// Weight of a new round trip time in the moving average, and of its deviation in the variance (as in RFC 6298).
+const double RTT_GAIN = 0.125;
+const double RTT_VARIANCE_GAIN = 0.25;
+/// Deviations a peer is given on top of its round trip time before it's considered to be timing out.
+const double RTT_VARIANCE_FACTOR = 4;
+/// Shortest timeout given to any peer, however fast it usually answers.
+const std::chrono::milliseconds MIN_PEER_TIMEOUT(200);
+/// Round trip times kept per peer for percentiles, and how many it takes to tell one.
+const size_t RTT_WINDOW = 64;
+const size_t MIN_PERCENTILE_SAMPLES = 10;
+/// Commands that don't change anything, so sending them twice is harmless.
+const std::unordered_set<std::string> READ_ONLY_COMMANDS = { "AB", "BA", "BN", "BS" };
+/// Longest answer requestAsync() reads, the same as Socket takes from anyone.
+const size_t MAX_ANSWER_LENGTH = 65536;
+
+std::string peerKey(const std::string& address, int port)
+{
+	return address + ":" + std::to_string(port);
+}
+
+struct PeerPool::AsyncRequest : public std::enable_shared_from_this<AsyncRequest>
+{
+	std::string address;
+	int port;
+	std::string line;
+	CancellationToken token;
+	std::function<void(std::exception_ptr, const Packet&)> done;
+	boost::asio::strand<boost::asio::io_context::executor_type> strand;
+	boost::asio::ip::tcp::socket socket;
+	boost::asio::steady_timer timer;
+	std::string received;
+	std::chrono::steady_clock::time_point sent;
+	std::unique_ptr<CancellationSubscription> subscription;
+	bool finished = false;
+
+	AsyncRequest(const std::string& address, int port, const std::string& line, const CancellationToken& token, std::function<void(std::exception_ptr, const Packet&)> done) : address(address), port(port), line(line + "\r\n"), token(token), done(std::move(done)), strand(boost::asio::make_strand(Reactor::instance()->context())), socket(strand), timer(strand)
+	{
+	}
+
+	/**
+	 * Connects, sends the line and reads the answer. Everything runs on the request's strand.
+	 */
+	void start()
+	{
+		std::shared_ptr<AsyncRequest> self = shared_from_this();
+		std::weak_ptr<AsyncRequest> weakSelf = self;
+		subscription.reset(new CancellationSubscription(token, [weakSelf]()
+		{
+			std::shared_ptr<AsyncRequest> self = weakSelf.lock();
+			if (self == nullptr) return;
+			boost::asio::post(self->strand, [self]()
+			{
+				self->fail(std::make_exception_ptr(InterbanqaException("Cancelled")));
+			});
+		}));
+		boost::asio::post(strand, [self]()
+		{
+			if (self->token.cancelled())
+			{
+				self->fail(std::make_exception_ptr(InterbanqaException("Cancelled")));
+				return;
+			}
+			self->timer.expires_at(self->token.deadline());
+			self->timer.async_wait([self](const boost::system::error_code& error)
+			{
+				if (error || self->finished) return;
+				PeerPool::instance()->timedOut(self->address, self->port);
+				self->fail(std::make_exception_ptr(InterbanqaException("No response from " + self->address)));
+			});
+			boost::system::error_code error;
+			boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address_v4(self->address, error), self->port);
+			if (error)
+			{
+				self->fail(std::make_exception_ptr(boost::system::system_error(error)));
+				return;
+			}
+			self->socket.async_connect(endpoint, [self](const boost::system::error_code& error)
+			{
+				if (error)
+				{
+					self->fail(std::make_exception_ptr(boost::system::system_error(error)));
+					return;
+				}
+				boost::system::error_code ignored;
+				self->socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+				++stats::PEER_CONNECTS;
+				self->write();
+			});
+		});
+	}
+
+	void write()
+	{
+		std::shared_ptr<AsyncRequest> self = shared_from_this();
+		sent = std::chrono::steady_clock::now();
+		boost::asio::async_write(socket, boost::asio::buffer(line), [self](const boost::system::error_code& error, size_t)
+		{
+			if (error) self->fail(std::make_exception_ptr(InterbanqaException("No response from " + self->address)));
+			else self->read();
+		});
+	}
+
+	void read()
+	{
+		std::shared_ptr<AsyncRequest> self = shared_from_this();
+		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(received, MAX_ANSWER_LENGTH), '\n', [self](const boost::system::error_code& error, size_t size)
+		{
+			if (error)
+			{
+				self->fail(std::make_exception_ptr(InterbanqaException("No response from " + self->address)));
+				return;
+			}
+			if (self->finished) return;
+			double rtt = std::chrono::duration<double>(std::chrono::steady_clock::now() - self->sent).count();
+			PeerPool::instance()->measured(self->address, self->port, rtt);
+			size_t length = size - 1;
+			if (length > 0 && self->received[length - 1] == '\r') --length;
+			self->finish(nullptr, Packet(self->received.substr(0, length), nullptr));
+		});
+	}
+
+	void fail(std::exception_ptr failure)
+	{
+		finish(failure, Packet());
+	}
+
+	/**
+	 * Closes the connection and hands the outcome over, once. Expects to run on the strand.
+	 */
+	void finish(std::exception_ptr failure, const Packet& answer)
+	{
+		if (finished) return;
+		finished = true;
+		boost::system::error_code ignored;
+		timer.cancel(ignored);
+		socket.close(ignored);
+		subscription.reset();
+		done(failure, answer);
+	}
+};
+
+PeerPool::PeerPool() : evictionTimer(Reactor::instance()->context())
+{
+	running = true;
+	evict();
+}
+
+PeerPool::~PeerPool()
+{
+	stop();
+}
+
+std::shared_ptr<Socket> PeerPool::acquire(const std::string& address, int port, const CancellationToken& token, bool& reused)
+{
+	poolLocker.lock();
+	auto it = idle.find(peerKey(address, port));
+	while (it != idle.end() && !it->second.empty())
+	{
+		std::shared_ptr<Socket> socket = it->second.back().socket;
+		it->second.pop_back();
+		if (socket->isOpen() && socket->pending() == 0)
+		{
+			poolLocker.unlock();
+			reused = true;
+			++stats::PEER_REUSES;
+			return socket;
+		}
+		socket->close();
+		++stats::PEER_EVICTIONS;
+	}
+	poolLocker.unlock();
+
+	reused = false;
+	std::shared_ptr<Socket> socket = std::make_shared<Socket>();
+	socket->connectV4(address, std::to_string(port), token);
+	boost::system::error_code ignored;
+	socket->raw()->set_option(boost::asio::socket_base::keep_alive(true), ignored);
+	socket->raw()->set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+	++stats::PEER_CONNECTS;
+	return socket;
+}
+
+void PeerPool::release(const std::string& address, int port, std::shared_ptr<Socket> socket)
+{
+	if (socket->isOpen() && socket->pending() == 0)
+	{
+		std::lock_guard<std::mutex> lock(poolLocker);
+		std::vector<Idle>& sockets = idle[peerKey(address, port)];
+		if (running && sockets.size() < (size_t)config::PEER_POOL_SIZE)
+		{
+			sockets.push_back({socket, std::chrono::steady_clock::now()});
+			return;
+		}
+	}
+	socket->close();
+}
+
+std::shared_ptr<PeerLink> PeerPool::link(const std::string& address, int port, const CancellationToken& token, bool& reused)
+{
+	if (!config::PEER_MULTIPLEX)
+	{
+		return nullptr;
+	}
+	std::string key = peerKey(address, port);
+	poolLocker.lock();
+	auto existing = links.find(key);
+	if (existing != links.end())
+	{
+		if (existing->second->isOpen())
+		{
+			std::shared_ptr<PeerLink> res = existing->second;
+			poolLocker.unlock();
+			reused = true;
+			return res;
+		}
+		links.erase(existing);
+	}
+	auto plain = plainPeers.find(key);
+	if (plain != plainPeers.end())
+	{
+		if (plain->second > std::chrono::steady_clock::now())
+		{
+			poolLocker.unlock();
+			return nullptr;
+		}
+		plainPeers.erase(plain);
+	}
+	poolLocker.unlock();
+
+	reused = false;
+	bool reusedSocket;
+	std::shared_ptr<Socket> socket = acquire(address, port, token, reusedSocket);
+	bool agreed;
+	try
+	{
+		agreed = PeerLink::negotiate(socket, token);
+	}
+	catch (const InterbanqaException& e)
+	{
+		socket->close();
+		throw;
+	}
+	if (!agreed)
+	{
+		runtime_log.log("Bank at " + key + " doesn't support request IDs", LOG_INFO);
+		poolLocker.lock();
+		plainPeers[key] = std::chrono::steady_clock::now() + PLAIN_PEER_RETRY;
+		poolLocker.unlock();
+		release(address, port, socket);
+		return nullptr;
+	}
+
+	std::shared_ptr<PeerLink> res = std::make_shared<PeerLink>(socket);
+	res->start();
+	std::lock_guard<std::mutex> lock(poolLocker);
+	std::shared_ptr<PeerLink>& stored = links[key];
+	if (stored != nullptr && stored->isOpen())
+	{
+		// Somebody else negotiated one meanwhile; the spare one can't go back to the exclusive pool
+		res->close();
+		return stored;
+	}
+	stored = res;
+	++stats::PEER_LINKS;
+	return res;
+}
+
+void PeerPool::evict()
+{
+	std::vector<std::shared_ptr<Socket>> evicted;
+	poolLocker.lock();
+	if (!running)
+	{
+		poolLocker.unlock();
+		return;
+	}
+	auto expired = std::chrono::steady_clock::now() - std::chrono::seconds(config::PEER_IDLE_TIMEOUT);
+	for (auto it = idle.begin(); it != idle.end();)
+	{
+		std::vector<Idle>& sockets = it->second;
+		for (size_t index = 0; index < sockets.size();)
+		{
+			if (sockets[index].since <= expired || !sockets[index].socket->isOpen() || sockets[index].socket->pending() > 0)
+			{
+				evicted.emplace_back(std::move(sockets[index].socket));
+				sockets.erase(sockets.begin() + index);
+			}
+			else
+			{
+				++index;
+			}
+		}
+		if (sockets.empty()) it = idle.erase(it);
+		else ++it;
+	}
+	std::vector<std::shared_ptr<PeerLink>> closing;
+	for (auto it = links.begin(); it != links.end();)
+	{
+		if (!it->second->isOpen() || it->second->idleSince(expired))
+		{
+			closing.emplace_back(std::move(it->second));
+			it = links.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	evictionTimer.expires_after(EVICTION_INTERVAL);
+	evictionTimer.async_wait([this](const boost::system::error_code& error)
+	{
+		if (!error) evict();
+	});
+	poolLocker.unlock();
+
+	for (auto& socket : evicted)
+	{
+		socket->close();
+		++stats::PEER_EVICTIONS;
+	}
+	for (auto& link : closing)
+	{
+		link->close();
+		++stats::PEER_EVICTIONS;
+	}
+}
+
+Packet PeerPool::request(const std::string& address, int port, const std::string& line, const CancellationToken& token, bool exclusive)
+{
+	auto start = std::chrono::steady_clock::now();
+	try
+	{
+		Packet response = exchange(address, port, line, token, exclusive);
+		measured(address, port, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		return response;
+	}
+	catch (const std::exception& e)
+	{
+		// Only the deadline passing counts, not the request being given up on
+		if (std::chrono::steady_clock::now() >= token.deadline())
+		{
+			timedOut(address, port);
+		}
+		throw;
+	}
+}
+
+void PeerPool::requestAsync(const std::string& address, int port, const std::string& line, const CancellationToken& token, std::function<void(std::exception_ptr failure, const Packet& answer)> done)
+{
+	std::make_shared<AsyncRequest>(address, port, line, token, std::move(done))->start();
+}
+
+void PeerPool::measured(const std::string& address, int port, double rtt)
+{
+	std::lock_guard<std::mutex> lock(latencyLocker);
+	Latency& latency = latencies[peerKey(address, port)];
+	if (latency.samples == 0)
+	{
+		latency.rtt = rtt;
+		latency.variance = rtt / 2;
+	}
+	else
+	{
+		latency.variance += RTT_VARIANCE_GAIN * (std::abs(latency.rtt - rtt) - latency.variance);
+		latency.rtt += RTT_GAIN * (rtt - latency.rtt);
+	}
+	if (latency.recent.size() < RTT_WINDOW) latency.recent.emplace_back(rtt);
+	else latency.recent[latency.samples % RTT_WINDOW] = rtt;
+	++latency.samples;
+	latency.timeouts = 0;
+}
+
+void PeerPool::timedOut(const std::string& address, int port)
+{
+	std::lock_guard<std::mutex> lock(latencyLocker);
+	auto latency = latencies.find(peerKey(address, port));
+	if (latency != latencies.end()) ++latency->second.timeouts;
+}
+
+std::chrono::milliseconds PeerPool::timeout(const std::string& address, int port)
+{
+	std::chrono::milliseconds ceiling((long long int)(1000 * config::TIMEOUT));
+	std::lock_guard<std::mutex> lock(latencyLocker);
+	auto it = latencies.find(peerKey(address, port));
+	if (it == latencies.end())
+	{
+		return ceiling;
+	}
+	const Latency& latency = it->second;
+	auto res = std::max(MIN_PEER_TIMEOUT, std::chrono::milliseconds((long long int)std::ceil(1000 * (latency.rtt + RTT_VARIANCE_FACTOR * latency.variance))));
+	for (int timeout = 0; timeout < latency.timeouts && res < ceiling; ++timeout)
+	{
+		res *= 2;
+	}
+	return std::min(res, ceiling);
+}
+
+std::chrono::microseconds PeerPool::percentile(const std::string& address, int port, int percentile)
+{
+	std::vector<double> recent;
+	latencyLocker.lock();
+	auto it = latencies.find(peerKey(address, port));
+	if (it != latencies.end()) recent = it->second.recent;
+	latencyLocker.unlock();
+	if (recent.size() < MIN_PERCENTILE_SAMPLES)
+	{
+		return std::chrono::microseconds(0);
+	}
+	size_t index = std::min(recent.size() - 1, (size_t)std::ceil(percentile / 100.0 * recent.size()) - 1);
+	std::nth_element(recent.begin(), recent.begin() + index, recent.end());
+	return std::chrono::microseconds((long long int)std::ceil(1e6 * recent[index]));
+}
+
+std::string PeerPool::latencyReport()
+{
+	std::vector<std::pair<std::string, Latency>> peers;
+	latencyLocker.lock();
+	peers.assign(latencies.begin(), latencies.end());
+	latencyLocker.unlock();
+	std::sort(peers.begin(), peers.end(), [](const std::pair<std::string, Latency>& a, const std::pair<std::string, Latency>& b)
+	{
+		return a.first < b.first;
+	});
+
+	std::string res;
+	for (auto& peer : peers)
+	{
+		size_t colon = peer.first.find(':');
+		std::chrono::milliseconds limit = timeout(peer.first.substr(0, colon), std::stoi(peer.first.substr(colon + 1)));
+		res += "peer_rtt[" + peer.first + "]: rtt_us=" + std::to_string((long long int)(1e6 * peer.second.rtt)) + " rttvar_us=" + std::to_string((long long int)(1e6 * peer.second.variance)) + " timeout_ms=" + std::to_string(limit.count()) + " samples=" + std::to_string(peer.second.samples) + " timeouts=" + std::to_string(peer.second.timeouts) + "\n";
+	}
+	return res;
+}
+
+Packet PeerPool::exchange(const std::string& address, int port, const std::string& line, const CancellationToken& token, bool exclusive)
+{
+	bool retried = false;
+	while (!exclusive)
+	{
+		bool reusedLink = false;
+		bool sent = false;
+		std::shared_ptr<PeerLink> shared = link(address, port, token, reusedLink);
+		if (shared == nullptr)
+		{
+			break;
+		}
+		try
+		{
+			++stats::PEER_MULTIPLEXED;
+			return shared->request(line, token, sent);
+		}
+		catch (const InterbanqaException& e)
+		{
+			token.check();
+			// As with pooled connections below, a change the peer may have received isn't sent again
+			if (!reusedLink || retried || shared->isOpen() || (sent && !readOnly(line)))
+			{
+				throw;
+			}
+			retried = true;
+			runtime_log.log("Link to " + peerKey(address, port) + " died, reconnecting", LOG_INFO);
+		}
+	}
+
+	while (true)
+	{
+		bool reused = false;
+		bool sent = false;
+		std::shared_ptr<Socket> socket = acquire(address, port, token, reused);
+		try
+		{
+			socket->send(line + "\r\n");
+			sent = true;
+			if (socket->wait(token))
+			{
+				Packet response = socket->next();
+				release(address, port, socket);
+				return response;
+			}
+		}
+		catch (const InterbanqaException& e)
+		{
+			// Send failed, the connection is dead
+		}
+		bool died = !socket->isOpen();
+		socket->close();
+		token.check();
+		// The peer may have closed a pooled connection just as it was taken, so that one gets another chance on a new
+		// connection, unless the peer may have received a change already
+		if (!reused || !died || (sent && !readOnly(line)))
+		{
+			throw InterbanqaException("No response from " + address);
+		}
+		runtime_log.log("Pooled connection to " + peerKey(address, port) + " died, reconnecting", LOG_INFO);
+	}
+}
+
+bool PeerPool::readOnly(const std::string& line)
+{
+	return READ_ONLY_COMMANDS.count(line.substr(0, line.find(' '))) > 0;
+}
+
+void PeerPool::stop()
+{
+	std::unordered_map<std::string, std::vector<Idle>> closing;
+	poolLocker.lock();
+	running = false;
+	boost::system::error_code ignored;
+	evictionTimer.cancel(ignored);
+	closing.swap(idle);
+	std::unordered_map<std::string, std::shared_ptr<PeerLink>> closingLinks;
+	closingLinks.swap(links);
+	poolLocker.unlock();
+	for (auto& peer : closing)
+	{
+		for (auto& entry : peer.second)
+		{
+			entry.socket->close();
+		}
+	}
+	for (auto& peer : closingLinks)
+	{
+		peer.second->close();
+	}
+}
+
+std::shared_ptr<PeerPool> PeerPool::_instance;
+
+std::shared_ptr<PeerPool> PeerPool::instance()
+{
+	if (_instance == nullptr) _instance.reset(new PeerPool);
+	return _instance;
+}
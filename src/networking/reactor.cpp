@@ -0,0 +1,68 @@
+#include "networking/reactor.hpp"
+#include "config.hpp"
+#include "log.hpp"
+
+void reactorThread(boost::asio::io_context* context)
+{
+	while (true)
+	{
+		try
+		{
+			context->run();
+			return;
+		}
+		catch (const std::exception& e)
+		{
+			runtime_log.log((std::string)"Unhandled error in network thread: " + e.what(), LOG_ERROR);
+		}
+	}
+}
+
+Reactor::Reactor() : work(boost::asio::make_work_guard(ioContext))
+{
+	int threads = config::IO_THREADS;
+	if (threads <= 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	ioThreads.reserve(threads);
+	for (int index = 0; index < threads; ++index)
+	{
+		ioThreads.emplace_back(reactorThread, &ioContext);
+	}
+	running = true;
+}
+
+Reactor::~Reactor()
+{
+	stop();
+}
+
+boost::asio::io_context& Reactor::context()
+{
+	return ioContext;
+}
+
+void Reactor::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+	running = false;
+	work.reset();
+	ioContext.stop();
+	for (auto& t : ioThreads)
+	{
+		if (t.joinable()) t.join();
+	}
+	ioThreads.clear();
+}
+
+std::shared_ptr<Reactor> Reactor::_instance;
+
+std::shared_ptr<Reactor> Reactor::instance()
+{
+	if (_instance == nullptr) _instance.reset(new Reactor);
+	return _instance;
+}
@@ -28,18 +28,25 @@
  */
 
 #include "networking/socket.hpp"
+#include <future>
 #include <string>
-#include <thread>
 #include "client.hpp"
-#include <iostream>
+#include "config.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "networking/acceptor.hpp"
+#include "networking/reactor.hpp"
+#include "stats.hpp"
 
-void socketReceiveThread(Socket* socket)
-{
-	socket->receive();
-}
-void clientHandlerThread(Client* client)
+/// A peer sending a longer line than this without a newline is disconnected.
+const size_t MAX_LINE_LENGTH = 65536;
+/// Maximum amount of buffers gathered into a single write.
+const size_t MAX_WRITE_BUFFERS = 64;
+
+Socket::Socket()
 {
-	client->run();
+	socket.reset(new boost::asio::ip::tcp::socket(Reactor::instance()->context()));
+	incomingPackets = std::make_shared<RingQueue<Packet>>(config::QUEUE_DEPTH);
 }
 
 Socket::~Socket()
@@ -49,21 +56,32 @@ Socket::~Socket()
 
 void Socket::close()
 {
-	receiving = false;
-	if (socket != nullptr)
+	bool wasReceiving = receiving.exchange(false);
+	internalLocker.lock();
+	if (socket != nullptr && socket->is_open())
 	{
-		socket->close();
+		boost::system::error_code ignored;
+		socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+		socket->close(ignored);
 	}
+	std::shared_ptr<Client> released = client;
+	client = nullptr;
+	std::function<void()> closing;
+	closing.swap(listener);
+	internalLocker.unlock();
+
+	incomingLocker.lock();
 	incomingLocker.unlock();
-	internalLocker.lock();
-	if (receiveThread.joinable())
+	incomingCondition.notify_all();
+	if (closing)
 	{
-		receiveThread.join();
+		closing();
 	}
-	internalLocker.unlock();
-	if (receiveThread.joinable())
+
+	std::shared_ptr<Acceptor> acceptor = owner.lock();
+	if (wasReceiving && acceptor != nullptr)
 	{
-		handlerThread.join();
+		acceptor->closed(this);
 	}
 }
 
@@ -74,129 +92,378 @@ std::shared_ptr<boost::asio::ip::tcp::socket> Socket::raw() const
 
 void Socket::receive()
 {
-	Buffer receiveBuffer;
+	internalLocker.lock();
+	if (receiving && socket->is_open())
+	{
+		std::shared_ptr<Socket> self = shared_from_this();
+		socket->async_read_some(boost::asio::buffer(receiveChunk), [self](const boost::system::error_code& error, size_t size)
+		{
+			self->received(error, size);
+		});
+	}
+	internalLocker.unlock();
+}
 
-	while (receiving)
+void Socket::received(const boost::system::error_code& error, size_t size)
+{
+	if (error)
 	{
-		try
+		switch (error.value())
 		{
-			if (socket != nullptr && socket->is_open())
-			{
-				internalLocker.lock();
-				boost::asio::streambuf buffer;
-				try
-				{
-					//socket->non_blocking(false);
-					boost::asio::read_until(*socket, buffer, '\n');
-					//socket->non_blocking(true);
-					std::getline(std::istream(&buffer), receiveBuffer);
-				}
-				catch (...)
-				{
-					internalLocker.unlock();
-					throw;
-				}
-				internalLocker.unlock();
-
-				Packet incomingPacket(receiveBuffer, socket);
-				incomingLocker.lock();
-				incomingPackets.emplace_back(incomingPacket);
-				incomingLocker.unlock();
-			}
-			else
-			{
-				receiving = false;
-			}
+			case boost::asio::error::eof:
+			case boost::asio::error::operation_aborted:
+			case boost::asio::error::connection_reset:
+				break;
+			default:
+				runtime_log.log("Socket error: " + error.message(), LOG_WARNING);
 		}
-		catch (const boost::wrapexcept<boost::system::system_error>& error)
+		close();
+		return;
+	}
+
+	size_t scanned = receiveBuffer.size();
+	receiveBuffer.append(receiveChunk, size);
+
+	size_t lineStart = 0;
+	size_t lineEnd;
+	while ((lineEnd = receiveBuffer.find('\n', scanned)) != Buffer::npos)
+	{
+		size_t length = lineEnd - lineStart;
+		if (length > 0 && receiveBuffer[lineEnd - 1] == '\r') --length;
+		overflow.emplace_back(receiveBuffer.substr(lineStart, length), socket);
+		if (dispatched && ++inflight > (size_t)config::MAX_INFLIGHT)
 		{
-			switch (error.code().value())
-			{
-				case boost::asio::error::would_block:
-					std::this_thread::sleep_for(std::chrono::milliseconds(1));
-					break;
-				case boost::asio::error::eof:
-					receiving = false;
-					break;
-				default:
-					std::cout << error.what() << std::endl;
-					//throw;
-			}
+			overflow.back().shed(true);
 		}
+		lineStart = lineEnd + 1;
+		scanned = lineStart;
+	}
+	receiveBuffer.erase(0, lineStart);
+
+	if (receiveBuffer.size() > MAX_LINE_LENGTH)
+	{
+		runtime_log.log("Dropping connection sending a line longer than " + std::to_string(MAX_LINE_LENGTH) + " bytes", LOG_WARNING);
+		close();
+		return;
+	}
+
+	proceed();
+}
+
+void Socket::proceed()
+{
+	size_t queued = 0;
+	while (queued < overflow.size() && incomingPackets->push(std::move(overflow[queued])))
+	{
+		++queued;
+	}
+	overflow.erase(overflow.begin(), overflow.begin() + queued);
+	if (queued > 0)
+	{
+		signal();
+	}
+
+	if (overflow.empty())
+	{
+		receive();
+		return;
+	}
+
+	paused = true;
+	std::shared_ptr<Acceptor> acceptor = owner.lock();
+	if (!dispatched && acceptor != nullptr)
+	{
+		acceptor->stalled(shared_from_this());
+	}
+	// The consumer may have made room before it could notice the pause
+	if (incomingPackets->size() < incomingPackets->capacity())
+	{
+		resume();
+	}
+}
+
+void Socket::signal()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting > 0)
+	{
+		incomingLocker.lock();
+		incomingLocker.unlock();
+		incomingCondition.notify_all();
+	}
+
+	internalLocker.lock();
+	std::shared_ptr<Client> handler = client;
+	std::function<void()> listening = listener;
+	internalLocker.unlock();
+	if (handler != nullptr)
+	{
+		handler->notify();
+	}
+	if (listening)
+	{
+		listening();
+	}
+}
+
+void Socket::resume()
+{
+	if (paused.exchange(false))
+	{
+		std::shared_ptr<Socket> self = shared_from_this();
+		boost::asio::post(Reactor::instance()->context(), [self]()
+		{
+			self->proceed();
+		});
 	}
 }
 
 void Socket::start(bool dispatchClient)
 {
-	socket->non_blocking(true);
+	boost::system::error_code error;
+	_address = socket->remote_endpoint(error).address().to_string();
 	receiving = true;
-	receiveThread = std::thread(socketReceiveThread, this);
 	if (dispatchClient)
 	{
-		client = std::make_unique<Client>(shared_from_this());
-		handlerThread = std::thread(clientHandlerThread, client.get());
+		dispatched = true;
+		internalLocker.lock();
+		client = std::make_shared<Client>(shared_from_this());
+		internalLocker.unlock();
 	}
+	receive();
+}
+void Socket::start(std::shared_ptr<RingQueue<Packet>> queue)
+{
+	incomingPackets = queue;
+	start();
+}
+
+void Socket::listen(std::function<void()> listener)
+{
+	internalLocker.lock();
+	this->listener = listener;
+	internalLocker.unlock();
+}
+
+void Socket::reject(Buffer message)
+{
+	lingering = true;
+	send(message);
+}
+
+void Socket::own(std::weak_ptr<Acceptor> owner)
+{
+	this->owner = owner;
 }
 
 bool Socket::isOpen() const
 {
 	return (socket != nullptr && socket->is_open());
 }
+std::string Socket::address() const
+{
+	return _address;
+}
 
 size_t Socket::pending()
 {
-	incomingLocker.lock();
-	size_t res = incomingPackets.size();
-	incomingLocker.unlock();
-	return res;
+	return incomingPackets->size();
 }
 Packet Socket::next()
 {
-	incomingLocker.lock();
-	Packet res = incomingPackets[0];
-	incomingPackets.erase(incomingPackets.begin());
-	incomingLocker.unlock();
+	Packet res;
+	if (!incomingPackets->pop(res))
+	{
+		throw InterbanqaException("No pending packets");
+	}
+	if (paused) resume();
+	return res;
+}
+size_t Socket::next(std::vector<Packet>& packets, size_t max)
+{
+	size_t res = incomingPackets->popBatch(packets, max);
+	if (res > 0 && paused) resume();
 	return res;
 }
 
-void Socket::accept(boost::asio::ip::tcp::acceptor& acceptor)
+void Socket::handled()
 {
-	close();
-	if (socket == nullptr)
+	--inflight;
+}
+
+bool Socket::wait(const CancellationToken& token)
+{
+	std::weak_ptr<Socket> weakSelf = weak_from_this();
+	CancellationSubscription subscription(token, [weakSelf]()
 	{
-		socket.reset(new boost::asio::ip::tcp::socket(ioContext));
-	}
-	acceptor.accept(*socket);
-	start(true);
+		std::shared_ptr<Socket> self = weakSelf.lock();
+		if (self != nullptr)
+		{
+			self->incomingLocker.lock();
+			self->incomingLocker.unlock();
+			self->incomingCondition.notify_all();
+		}
+	});
+	std::unique_lock<std::mutex> lock(incomingLocker);
+	++waiting;
+	bool res = incomingCondition.wait_until(lock, token.deadline(), [this, &token]()
+	{
+		return !incomingPackets->empty() || !receiving || token.cancelled();
+	}) && !incomingPackets->empty();
+	--waiting;
+	return res;
 }
-void Socket::connectV4(std::string ip, std::string port)
+
+void Socket::connectV4(std::string ip, std::string port, const CancellationToken& token)
 {
 	close();
-	if (socket == nullptr)
-	{
-		socket.reset(new boost::asio::ip::tcp::socket(ioContext));
-	}
-	boost::asio::ip::tcp::resolver resolver(ioContext);
-	boost::asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(boost::asio::ip::tcp::v4(), ip, port);
-	boost::asio::connect(*socket, endpoints);
-	start();
+	receiveBuffer.clear();
+	overflow.clear();
+	boost::asio::ip::tcp::resolver resolver(Reactor::instance()->context());
+	connect(resolver.resolve(boost::asio::ip::tcp::v4(), ip, port), token);
 }
-void Socket::connectV6(std::string ip, std::string port)
+void Socket::connectV6(std::string ip, std::string port, const CancellationToken& token)
 {
 	close();
-	if (socket == nullptr)
+	receiveBuffer.clear();
+	overflow.clear();
+	boost::asio::ip::tcp::resolver resolver(Reactor::instance()->context());
+	connect(resolver.resolve(boost::asio::ip::tcp::v6(), ip, port), token);
+}
+
+void Socket::connect(const boost::asio::ip::tcp::resolver::results_type& endpoints, const CancellationToken& token)
+{
+	token.check();
+	std::shared_ptr<std::promise<boost::system::error_code>> connected = std::make_shared<std::promise<boost::system::error_code>>();
+	std::future<boost::system::error_code> result = connected->get_future();
+	internalLocker.lock();
+	boost::asio::async_connect(*socket, endpoints, [connected](const boost::system::error_code& error, const boost::asio::ip::tcp::endpoint&)
+	{
+		connected->set_value(error);
+	});
+	internalLocker.unlock();
+
+	std::weak_ptr<Socket> weakSelf = weak_from_this();
+	CancellationSubscription subscription(token, [weakSelf]()
+	{
+		std::shared_ptr<Socket> self = weakSelf.lock();
+		if (self != nullptr)
+		{
+			self->close();
+		}
+	});
+	if (result.wait_until(token.deadline()) == std::future_status::timeout)
+	{
+		close();
+	}
+	boost::system::error_code error = result.get();
+	if (token.cancelled())
 	{
-		socket.reset(new boost::asio::ip::tcp::socket(ioContext));
+		close();
+		throw InterbanqaException("Cancelled");
+	}
+	if (error)
+	{
+		boost::throw_exception(boost::system::system_error(error));
 	}
-	boost::asio::ip::tcp::resolver resolver(ioContext);
-	boost::asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(boost::asio::ip::tcp::v6(), ip, port);
-	boost::asio::connect(*socket, endpoints);
 	start();
 }
 
 void Socket::send(Buffer buffer)
 {
+	if (buffer.empty())
+	{
+		return;
+	}
+	std::unique_lock<std::mutex> lock(outgoingLocker);
+	if (!isOpen())
+	{
+		throw InterbanqaException("Connection closed");
+	}
+	outgoingBytes += buffer.size();
+	outgoing.emplace_back(std::move(buffer));
+	if (writing)
+	{
+		return;
+	}
+	writing = true;
+	lock.unlock();
+	write();
+}
+
+bool Socket::congested()
+{
+	outgoingLocker.lock();
+	bool res = outgoingBytes >= (size_t)config::SEND_HIGH_WATER;
+	outgoingLocker.unlock();
+	return res;
+}
+
+void Socket::write()
+{
+	std::vector<boost::asio::const_buffer> buffers;
+	outgoingLocker.lock();
+	buffers.reserve(std::min(outgoing.size(), MAX_WRITE_BUFFERS));
+	for (auto it = outgoing.begin(); it != outgoing.end() && buffers.size() < MAX_WRITE_BUFFERS; ++it)
+	{
+		size_t offset = (it == outgoing.begin() ? outgoingOffset : 0);
+		buffers.emplace_back(it->data() + offset, it->size() - offset);
+	}
+	outgoingLocker.unlock();
+
 	internalLocker.lock();
-	socket->send(boost::asio::buffer(buffer.data(), buffer.size()));
+	if (socket->is_open())
+	{
+		std::shared_ptr<Socket> self = shared_from_this();
+		socket->async_write_some(buffers, [self](const boost::system::error_code& error, size_t size)
+		{
+			self->written(error, size);
+		});
+		internalLocker.unlock();
+		return;
+	}
 	internalLocker.unlock();
+	written(boost::asio::error::not_connected, 0);
+}
+
+void Socket::written(const boost::system::error_code& error, size_t size)
+{
+	outgoingLocker.lock();
+	if (error)
+	{
+		outgoing.clear();
+		outgoingOffset = 0;
+		outgoingBytes = 0;
+		writing = false;
+		outgoingLocker.unlock();
+		close();
+		return;
+	}
+
+	bool wasCongested = outgoingBytes >= (size_t)config::SEND_HIGH_WATER;
+	outgoingBytes -= size;
+	bool relieved = wasCongested && outgoingBytes < (size_t)config::SEND_HIGH_WATER;
+	size += outgoingOffset;
+	while (!outgoing.empty() && size >= outgoing.front().size())
+	{
+		size -= outgoing.front().size();
+		outgoing.pop_front();
+	}
+	outgoingOffset = size;
+
+	bool more = !outgoing.empty();
+	writing = more;
+	outgoingLocker.unlock();
+	if (relieved)
+	{
+		signal();
+	}
+	if (more)
+	{
+		write();
+	}
+	else if (lingering)
+	{
+		close();
+	}
 }
\ No newline at end of file
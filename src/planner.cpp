@@ -0,0 +1,157 @@
+#include "planner.hpp"
+#include <algorithm>
+#include <limits>
+#include "exception.hpp"
+
+/**
+ * Sums up the chosen banks.
+ */
+RobberyPlan makePlan(const std::vector<Bank>& banks, const std::vector<size_t>& chosen)
+{
+	RobberyPlan res;
+	res.banks.reserve(chosen.size());
+	for (size_t index : chosen)
+	{
+		res.banks.emplace_back(banks[index]);
+		res.total += banks[index].balance;
+		res.clients += banks[index].clients;
+	}
+	return res;
+}
+
+/**
+ * @return Whether plan a affects fewer clients than b, or as many but takes less money beyond the target.
+ */
+bool better(const RobberyPlan& a, const RobberyPlan& b)
+{
+	if (a.clients != b.clients) return a.clients < b.clients;
+	return a.total < b.total;
+}
+
+RobberyPlan Planner::greedy(const std::vector<Bank>& banks, long long int target)
+{
+	std::vector<size_t> order;
+	order.reserve(banks.size());
+	for (size_t index = 0; index < banks.size(); ++index)
+	{
+		if (banks[index].balance > 0) order.emplace_back(index);
+	}
+	std::sort(order.begin(), order.end(), [&banks](size_t a, size_t b)
+	{
+		// balance / clients, compared without dividing; banks without clients come first
+		return (long double)banks[a].balance * banks[b].clients > (long double)banks[b].balance * banks[a].clients;
+	});
+
+	std::vector<size_t> chosen;
+	long long int total = 0;
+	for (size_t index : order)
+	{
+		if (total >= target) break;
+		chosen.emplace_back(index);
+		total += banks[index].balance;
+	}
+	if (total < target)
+	{
+		throw InterbanqaException("Not enough finances in network");
+	}
+
+	// Drops banks the target is reached without, the ones with the most clients first
+	std::sort(chosen.begin(), chosen.end(), [&banks](size_t a, size_t b)
+	{
+		return banks[a].clients > banks[b].clients;
+	});
+	std::vector<size_t> kept;
+	for (size_t index : chosen)
+	{
+		if (total - banks[index].balance >= target && banks[index].clients > 0)
+		{
+			total -= banks[index].balance;
+		}
+		else
+		{
+			kept.emplace_back(index);
+		}
+	}
+	return makePlan(banks, kept);
+}
+
+RobberyPlan Planner::plan(const std::vector<Bank>& banks, long long int target)
+{
+	if (target <= 0)
+	{
+		return RobberyPlan();
+	}
+	RobberyPlan best = greedy(banks, target);
+
+	// Banks without clients cost nothing, they're robbed for free
+	std::vector<size_t> freeBanks;
+	std::vector<size_t> items;
+	long long int remaining = target;
+	for (size_t index = 0; index < banks.size(); ++index)
+	{
+		if (banks[index].balance <= 0) continue;
+		if (banks[index].clients <= 0)
+		{
+			freeBanks.emplace_back(index);
+			remaining -= banks[index].balance;
+		}
+		else
+		{
+			items.emplace_back(index);
+		}
+	}
+	if (remaining <= 0 || items.empty())
+	{
+		RobberyPlan res = makePlan(banks, freeBanks);
+		return better(res, best) ? res : best;
+	}
+
+	long long int buckets = std::max(1LL, std::min(MAX_PLANNER_BUCKETS, MAX_PLANNER_CELLS / (long long int)items.size()));
+	long long int unit = std::max(1LL, (remaining + buckets - 1) / buckets);
+	size_t goal = (remaining + unit - 1) / unit;
+
+	// cost[j]: fewest clients reaching at least j buckets, and the money that takes (the fewer, the better)
+	const long long int UNREACHABLE = std::numeric_limits<long long int>::max();
+	std::vector<long long int> cost(goal + 1, UNREACHABLE);
+	std::vector<long long int> money(goal + 1, 0);
+	cost[0] = 0;
+	std::vector<bool> taken(items.size() * (goal + 1), false);
+	for (size_t item = 0; item < items.size(); ++item)
+	{
+		const Bank& bank = banks[items[item]];
+		size_t weight = std::min<long long int>(bank.balance / unit, goal);
+		if (weight == 0) continue;
+		std::vector<bool>::iterator row = taken.begin() + item * (goal + 1);
+		for (size_t j = goal; j > 0; --j)
+		{
+			size_t from = (j > weight ? j - weight : 0);
+			if (cost[from] == UNREACHABLE) continue;
+			long long int candidate = cost[from] + bank.clients;
+			long long int candidateMoney = money[from] + bank.balance;
+			if (candidate < cost[j] || (candidate == cost[j] && candidateMoney < money[j]))
+			{
+				cost[j] = candidate;
+				money[j] = candidateMoney;
+				row[j] = true;
+			}
+		}
+	}
+	if (cost[goal] == UNREACHABLE)
+	{
+		return best;
+	}
+
+	std::vector<size_t> chosen = freeBanks;
+	size_t j = goal;
+	for (size_t item = items.size(); item-- > 0 && j > 0;)
+	{
+		if (taken[item * (goal + 1) + j])
+		{
+			chosen.emplace_back(items[item]);
+			size_t weight = std::min<long long int>(banks[items[item]].balance / unit, goal);
+			j = (j > weight ? j - weight : 0);
+		}
+	}
+	RobberyPlan res = makePlan(banks, chosen);
+	return better(res, best) ? res : best;
+}
@@ -0,0 +1,201 @@
+#include "portdirectory.hpp"
+#include <cstdio>
+#include <fstream>
+#include "config.hpp"
+#include "json.hpp"
+#include "log.hpp"
+#include "networking/reactor.hpp"
+#include "stats.hpp"
+#include "workerpool.hpp"
+
+const char PORT_CACHE_PORT_NAME[] = "port";
+const char PORT_CACHE_EXPIRES_NAME[] = "expires";
+/// How long changes wait to be saved, so a sweep learning many ports writes the file once.
+const std::chrono::seconds FLUSH_DELAY(5);
+
+PortDirectory::PortDirectory() : flushTimer(Reactor::instance()->context())
+{
+	if (!config::PORT_CACHE_PATH.empty())
+	{
+		load();
+	}
+}
+
+void PortDirectory::load()
+{
+	using json = nlohmann::json;
+	std::ifstream file(config::PORT_CACHE_PATH);
+	if (!file.is_open())
+	{
+		return;
+	}
+	json raw;
+	try
+	{
+		raw = json::parse(file);
+	}
+	catch (...)
+	{
+		runtime_log.log("Ignoring invalid port cache " + config::PORT_CACHE_PATH, LOG_WARNING);
+		return;
+	}
+	if (!raw.is_object())
+	{
+		return;
+	}
+
+	auto now = std::chrono::system_clock::now();
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	for (auto& item : raw.items())
+	{
+		const json& value = item.value();
+		if (!value.is_object() || !value.contains(PORT_CACHE_PORT_NAME) || !value.contains(PORT_CACHE_EXPIRES_NAME))
+		{
+			continue;
+		}
+		if (!value[PORT_CACHE_PORT_NAME].is_number_unsigned() || !value[PORT_CACHE_EXPIRES_NAME].is_number_integer())
+		{
+			continue;
+		}
+		Entry entry;
+		entry.port = value[PORT_CACHE_PORT_NAME];
+		entry.expires = std::chrono::system_clock::time_point(std::chrono::seconds((long long int)value[PORT_CACHE_EXPIRES_NAME]));
+		if (entry.expires > now && entry.port >= config::MIN_PORT && entry.port <= config::MAX_PORT)
+		{
+			entries[item.key()] = entry;
+		}
+	}
+	runtime_log.log("Loaded " + std::to_string(entries.size()) + " known bank ports from " + config::PORT_CACHE_PATH, LOG_INFO);
+}
+
+void PortDirectory::save()
+{
+	using json = nlohmann::json;
+	if (config::PORT_CACHE_PATH.empty())
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> saving(saveLocker);
+	json raw = json::object();
+	directoryLocker.lock();
+	if (!dirty)
+	{
+		directoryLocker.unlock();
+		return;
+	}
+	auto now = std::chrono::system_clock::now();
+	for (auto& entry : entries)
+	{
+		if (entry.second.expires > now)
+		{
+			raw[entry.first][PORT_CACHE_PORT_NAME] = entry.second.port;
+			raw[entry.first][PORT_CACHE_EXPIRES_NAME] = std::chrono::duration_cast<std::chrono::seconds>(entry.second.expires.time_since_epoch()).count();
+		}
+	}
+	dirty = false;
+	directoryLocker.unlock();
+
+	// Written aside and renamed, so a crash never leaves a truncated file behind
+	std::string temporary = config::PORT_CACHE_PATH + ".tmp";
+	std::ofstream file(temporary, std::ios::out | std::ios::trunc);
+	if (!file.is_open())
+	{
+		runtime_log.log("Couldn't write port cache " + temporary, LOG_WARNING);
+		return;
+	}
+	file << raw.dump(1, '\t');
+	file.close();
+	if (std::rename(temporary.c_str(), config::PORT_CACHE_PATH.c_str()) != 0)
+	{
+		runtime_log.log("Couldn't replace port cache " + config::PORT_CACHE_PATH, LOG_WARNING);
+	}
+}
+
+void PortDirectory::scheduleFlush()
+{
+	if (config::PORT_CACHE_PATH.empty() || flushScheduled)
+	{
+		return;
+	}
+	flushScheduled = true;
+	flushTimer.expires_after(FLUSH_DELAY);
+	flushTimer.async_wait([this](const boost::system::error_code& error)
+	{
+		if (!error) flush();
+	});
+}
+
+void PortDirectory::flush()
+{
+	bool submitted = WorkerPool::instance()->submit([this]()
+	{
+		save();
+	});
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	flushScheduled = false;
+	if (!submitted)
+	{
+		scheduleFlush();
+	}
+}
+
+int PortDirectory::find(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	auto it = entries.find(address);
+	if (it == entries.end())
+	{
+		++stats::PORT_CACHE_MISSES;
+		return 0;
+	}
+	if (it->second.expires <= std::chrono::system_clock::now())
+	{
+		entries.erase(it);
+		dirty = true;
+		++stats::PORT_CACHE_MISSES;
+		return 0;
+	}
+	++stats::PORT_CACHE_HITS;
+	return it->second.port;
+}
+
+void PortDirectory::learn(const std::string& address, int port)
+{
+	if (config::PORT_CACHE_TTL <= 0)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	auto it = entries.find(address);
+	bool changed = (it == entries.end() || it->second.port != port);
+	Entry& entry = entries[address];
+	entry.port = port;
+	entry.expires = std::chrono::system_clock::now() + std::chrono::seconds(config::PORT_CACHE_TTL);
+	dirty = true;
+	// Mere renewals are saved along with the next change, or on shutdown
+	if (changed)
+	{
+		scheduleFlush();
+	}
+}
+
+void PortDirectory::forget(const std::string& address, int port)
+{
+	std::lock_guard<std::mutex> lock(directoryLocker);
+	auto it = entries.find(address);
+	if (it != entries.end() && it->second.port == port)
+	{
+		entries.erase(it);
+		dirty = true;
+		++stats::PORT_CACHE_INVALIDATIONS;
+		scheduleFlush();
+	}
+}
+
+std::shared_ptr<PortDirectory> PortDirectory::_instance;
+
+std::shared_ptr<PortDirectory> PortDirectory::instance()
+{
+	if (_instance == nullptr) _instance.reset(new PortDirectory);
+	return _instance;
+}
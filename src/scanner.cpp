@@ -0,0 +1,382 @@
+#include "scanner.hpp"
+#include <algorithm>
+#include <cstring>
+#include "config.hpp"
+#include "log.hpp"
+#include "networking/reactor.hpp"
+#include "portdirectory.hpp"
+#include "stats.hpp"
+#include "stringops.hpp"
+
+const char SCAN_REQUEST[] = "BS\r\n";
+/// For banks that don't know BS. Sent one at a time, BN once BA is answered, as older banks read a single line per
+/// round trip and drop whatever came with it.
+const char FALLBACK_BALANCE_REQUEST[] = "BA\r\n";
+const char FALLBACK_CLIENTS_REQUEST[] = "BN\r\n";
+/// A peer answering with longer lines than this isn't a bank.
+const size_t MAX_SCAN_RESPONSE = 1024;
+
+struct Scanner::Probe : public std::enable_shared_from_this<Probe>
+{
+	std::shared_ptr<Scanner> owner;
+	std::string address;
+	int port;
+	boost::asio::strand<boost::asio::io_context::executor_type> strand;
+	boost::asio::ip::tcp::socket socket;
+	boost::asio::steady_timer timer;
+	std::string received;
+	std::vector<std::string> lines;
+	/// Whether the bank didn't know BS, and was asked for BA and BN instead.
+	bool fallback = false;
+	/// Whether the probe ran out of time, rather than being refused or answered with something else than a bank would.
+	bool expired = false;
+	bool done = false;
+
+	Probe(std::shared_ptr<Scanner> owner, const std::string& address, int port) : owner(owner), address(address), port(port), strand(boost::asio::make_strand(Reactor::instance()->context())), socket(strand), timer(strand)
+	{
+	}
+
+	/**
+	 * Connects, sends the request and reads the answers. Everything runs on the probe's strand.
+	 */
+	void start(std::chrono::steady_clock::time_point deadline)
+	{
+		std::shared_ptr<Probe> self = shared_from_this();
+		boost::asio::post(strand, [self, deadline]()
+		{
+			self->timer.expires_at(deadline);
+			self->timer.async_wait([self](const boost::system::error_code& error)
+			{
+				if (error) return;
+				self->expired = true;
+				self->fail();
+			});
+			boost::system::error_code error;
+			boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address_v4(self->address, error), self->port);
+			if (error)
+			{
+				self->fail();
+				return;
+			}
+			self->socket.async_connect(endpoint, [self](const boost::system::error_code& error)
+			{
+				if (error)
+				{
+					self->fail();
+					return;
+				}
+				if (self->owner->connectOnly)
+				{
+					Bank bank;
+					bank.address = self->address;
+					self->complete(true, bank);
+					return;
+				}
+				self->write(SCAN_REQUEST);
+			});
+		});
+	}
+
+	void write(const char* request)
+	{
+		std::shared_ptr<Probe> self = shared_from_this();
+		boost::asio::async_write(socket, boost::asio::buffer(request, std::strlen(request)), [self](const boost::system::error_code& error, size_t)
+		{
+			if (error) self->fail();
+			else self->read();
+		});
+	}
+
+	void read()
+	{
+		std::shared_ptr<Probe> self = shared_from_this();
+		boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(received, MAX_SCAN_RESPONSE), '\n', [self](const boost::system::error_code& error, size_t size)
+		{
+			if (error)
+			{
+				self->fail();
+				return;
+			}
+			self->lines.emplace_back(self->received.substr(0, size));
+			self->received.erase(0, size);
+			self->parse();
+		});
+	}
+
+	void parse()
+	{
+		if (!fallback)
+		{
+			std::vector<std::string> statistics = parseCommand(lines[0]);
+			if (statistics.size() >= 4 && statistics[0] == "BS")
+			{
+				Bank bank;
+				bank.address = address;
+				try
+				{
+					bank.balance = std::stoll(statistics[1]);
+					bank.clients = std::stoi(statistics[2]);
+					bank.version = std::stoull(statistics[3]);
+				}
+				catch (const std::exception& e)
+				{
+					fail();
+					return;
+				}
+				complete(true, bank);
+			}
+			else if (statistics.size() > 0 && statistics[0] == "ER")
+			{
+				fallback = true;
+				lines.clear();
+				write(FALLBACK_BALANCE_REQUEST);
+			}
+			else
+			{
+				fail();
+			}
+			return;
+		}
+
+		std::vector<std::string> balance = parseCommand(lines[0]);
+		if (balance.size() < 2 || balance[0] != "BA")
+		{
+			fail();
+			return;
+		}
+		if (lines.size() < 2)
+		{
+			write(FALLBACK_CLIENTS_REQUEST);
+			return;
+		}
+		std::vector<std::string> clients = parseCommand(lines[1]);
+		if (clients.size() < 2 || clients[0] != "BN")
+		{
+			fail();
+			return;
+		}
+		Bank bank;
+		bank.address = address;
+		try
+		{
+			bank.balance = std::stoll(balance[1]);
+			bank.clients = std::stoi(clients[1]);
+		}
+		catch (const std::exception& e)
+		{
+			fail();
+			return;
+		}
+		complete(true, bank);
+	}
+
+	void fail()
+	{
+		complete(false, Bank());
+	}
+
+	void complete(bool answered, const Bank& bank)
+	{
+		if (done)
+		{
+			return;
+		}
+		done = true;
+		boost::system::error_code ignored;
+		timer.cancel(ignored);
+		socket.close(ignored);
+		owner->finished(shared_from_this(), answered, bank);
+	}
+
+	/**
+	 * Abandons the probe from outside its strand.
+	 */
+	void abort()
+	{
+		std::shared_ptr<Probe> self = shared_from_this();
+		boost::asio::post(strand, [self]()
+		{
+			self->fail();
+		});
+	}
+};
+
+Scanner::Scanner()
+{
+	nextPort = config::MIN_PORT;
+	concurrency = config::SCAN_CONCURRENCY;
+}
+
+std::shared_ptr<Scanner> Scanner::network(const std::string& address, int prefixLength)
+{
+	boost::asio::ip::address_v4 addr = boost::asio::ip::make_address_v4(address);
+	boost::asio::ip::network_v4 network = boost::asio::ip::network_v4(addr, prefixLength);
+
+	std::shared_ptr<Scanner> res(new Scanner);
+	res->nextAddress = network.address().to_uint();
+	res->lastAddress = network.broadcast().to_uint();
+	return res;
+}
+
+std::shared_ptr<Scanner> Scanner::targets(const std::vector<std::string>& addresses)
+{
+	std::shared_ptr<Scanner> res(new Scanner);
+	res->listed.reserve(addresses.size());
+	for (auto& address : addresses)
+	{
+		res->listed.emplace_back(address, 0);
+	}
+	return res;
+}
+
+std::shared_ptr<Scanner> Scanner::listeners(const std::string& address)
+{
+	std::shared_ptr<Scanner> res = targets({ address });
+	res->connectOnly = true;
+	return res;
+}
+
+std::shared_ptr<Scanner> Scanner::endpoints(const std::vector<std::pair<std::string, int>>& endpoints)
+{
+	std::shared_ptr<Scanner> res(new Scanner);
+	res->listed = endpoints;
+	return res;
+}
+
+bool Scanner::nextTarget(std::string& address, int& port)
+{
+	while (true)
+	{
+		if (nextPort > config::MAX_PORT)
+		{
+			nextPort = config::MIN_PORT;
+			if (listed.empty()) ++nextAddress;
+			else ++nextIndex;
+		}
+		if (listed.empty() ? nextAddress >= lastAddress : nextIndex >= listed.size())
+		{
+			return false;
+		}
+		if (!listed.empty() && listed[nextIndex].second != 0)
+		{
+			address = listed[nextIndex].first;
+			port = listed[nextIndex].second;
+			++nextIndex;
+		}
+		else
+		{
+			address = listed.empty() ? boost::asio::ip::address_v4(nextAddress).to_string() : listed[nextIndex].first;
+			port = nextPort++;
+		}
+		if (!found.count(address))
+		{
+			return true;
+		}
+	}
+}
+
+void Scanner::launch()
+{
+	std::string address;
+	int port;
+	while (!stopped && active.size() < (size_t)concurrency && nextTarget(address, port))
+	{
+		std::shared_ptr<Probe> probe = std::make_shared<Probe>(shared_from_this(), address, port);
+		active.insert(probe);
+		++stats::SCAN_PROBES;
+		auto deadline = std::min(token.deadline(), std::chrono::steady_clock::now() + std::chrono::milliseconds(config::SCAN_PROBE_TIMEOUT));
+		probe->start(deadline);
+	}
+	if (active.empty())
+	{
+		exhausted = !stopped;
+		stopped = true;
+		scanCondition.notify_all();
+	}
+}
+
+void Scanner::finished(std::shared_ptr<Probe> probe, bool answered, const Bank& bank)
+{
+	if (answered && !connectOnly)
+	{
+		PortDirectory::instance()->learn(bank.address, probe->port);
+	}
+	std::lock_guard<std::mutex> lock(scanLocker);
+	active.erase(probe);
+	if (!answered && probe->expired)
+	{
+		expired.insert(probe->address);
+	}
+	if (answered)
+	{
+		openPorts[probe->address].emplace_back(probe->port);
+	}
+	// Something listening isn't a bank yet, so every port is tried
+	if (answered && !connectOnly && !found.count(bank.address))
+	{
+		found[bank.address] = bank;
+		++stats::SCAN_BANKS_FOUND;
+	}
+	launch();
+}
+
+void Scanner::throttle(int concurrency)
+{
+	std::lock_guard<std::mutex> lock(scanLocker);
+	this->concurrency = std::max(1, concurrency);
+}
+
+std::vector<Bank> Scanner::run(const CancellationToken& token)
+{
+	std::unique_lock<std::mutex> lock(scanLocker);
+	this->token = token;
+	launch();
+	lock.unlock();
+
+	std::shared_ptr<Scanner> self = shared_from_this();
+	CancellationSubscription subscription(token, [self]()
+	{
+		self->scanLocker.lock();
+		self->scanLocker.unlock();
+		self->scanCondition.notify_all();
+	});
+	lock.lock();
+	scanCondition.wait_until(lock, token.deadline(), [this, &token]()
+	{
+		return stopped || token.cancelled();
+	});
+	if (!stopped)
+	{
+		runtime_log.log("Scan stopped with " + std::to_string(active.size()) + " probes still running", LOG_INFO);
+	}
+	stopped = true;
+	for (auto& probe : active)
+	{
+		probe->abort();
+	}
+
+	std::vector<Bank> res;
+	res.reserve(found.size());
+	for (auto& bank : found)
+	{
+		res.emplace_back(bank.second);
+	}
+	return res;
+}
+
+bool Scanner::completed()
+{
+	std::lock_guard<std::mutex> lock(scanLocker);
+	return exhausted;
+}
+std::vector<int> Scanner::ports(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(scanLocker);
+	auto iterator = openPorts.find(address);
+	return iterator == openPorts.end() ? std::vector<int>() : iterator->second;
+}
+bool Scanner::timedOut(const std::string& address)
+{
+	std::lock_guard<std::mutex> lock(scanLocker);
+	return expired.count(address) > 0;
+}
\ No newline at end of file
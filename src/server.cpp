@@ -1,32 +1,107 @@
 #include "server.hpp"
 #include <thread>
 #include <iostream>
+#include "bankdirectory.hpp"
+#include "circuitbreaker.hpp"
 #include "config.hpp"
+#include "discovery.hpp"
+#include "gossip.hpp"
 #include "log.hpp"
 #include "stringops.hpp"
 #include "database/account.hpp"
+#include "database/singleton.hpp"
+#include "networking/peerpool.hpp"
+#include "networking/reactor.hpp"
+#include "portdirectory.hpp"
+#include "stats.hpp"
+#include "workerpool.hpp"
+
+std::mutex serverLocker;
+std::condition_variable serverCondition;
+bool serverRunning = false;
+
+void stopServer()
+{
+	serverLocker.lock();
+	serverRunning = false;
+	serverLocker.unlock();
+	serverCondition.notify_all();
+}
+
+/**
+ * Outlives the Server (it can't be interrupted while reading), so it only touches the globals above and singletons.
+ */
+void consoleThread()
+{
+	std::string cmd;
+	while (std::getline(std::cin, cmd))
+	{
+		if (cmd == "exit") break;
+		if (cmd == "stats") std::cout << statsReport() << PeerPool::instance()->latencyReport() << std::flush;
+		if (cmd == "checkpoint") std::cout << DBSingleton::instance()->checkpoint() << std::endl;
+	}
+	stopServer();
+}
+
+Server::Server() : signals(Reactor::instance()->context(), SIGINT, SIGTERM)
+{
+}
 
 Server::~Server()
 {
 	std::cout << "Server terminating" << std::endl;
 	runtime_log.log("Server terminating", LOG_INFO);
+	boost::system::error_code ignored;
+	signals.cancel(ignored);
 	connection.close();
+	BankDirectory::instance()->stop();
+	Gossip::instance()->stop();
+	Discovery::instance()->stop();
+	CircuitBreaker::instance()->stop();
+	WorkerPool::instance()->stop();
+	PeerPool::instance()->stop();
+	Reactor::instance()->stop();
+	PortDirectory::instance()->save();
 }
 
 void Server::start()
 {
+	// Created up front, rather than by whichever request needs them first
+	WorkerPool::instance();
+	PortDirectory::instance();
+	PeerPool::instance();
+	CircuitBreaker::instance()->start();
+	Discovery::instance()->start();
+	BankDirectory::instance()->start();
+	Gossip::instance()->start();
+
 	connection.host(config::ADDRESS, config::PORT);
 	std::cout << "Server hosted at " << config::ADDRESS << " port " << config::PORT << std::endl;
 
 	runtime_log.log("Interbanqa server listening at " + config::ADDRESS + ", port " + std::to_string(config::PORT), LOG_INFO);
-	std::string cmd;
-	bool running = true;
-	while (running)
+
+	serverLocker.lock();
+	serverRunning = true;
+	serverLocker.unlock();
+
+	signals.async_wait([this](const boost::system::error_code& error, int signal)
 	{
-		std::getline(std::cin, cmd);
+		if (!error)
+		{
+			runtime_log.log("Received signal " + std::to_string(signal), LOG_INFO);
+			stop();
+		}
+	});
+	std::thread(consoleThread).detach();
 
-		if (cmd == "exit") running = false;
+	std::unique_lock<std::mutex> lock(serverLocker);
+	serverCondition.wait(lock, []()
+	{
+		return !serverRunning;
+	});
+}
 
-		if (std::cin.eof()) running = false;
-	}
+void Server::stop()
+{
+	stopServer();
 }
\ No newline at end of file
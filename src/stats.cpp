@@ -0,0 +1,96 @@
+#include "stats.hpp"
+
+namespace stats
+{
+	std::atomic<long long int> CONNECTIONS_OPEN = 0;
+	std::atomic<long long int> CONNECTIONS_ACCEPTED = 0;
+	std::atomic<long long int> CONNECTIONS_SHED = 0;
+	std::atomic<long long int> REQUESTS_HANDLED = 0;
+	std::atomic<long long int> REQUESTS_SHED = 0;
+	std::atomic<long long int> REQUESTS_TIMED_OUT = 0;
+
+	std::atomic<long long int> WORKER_QUEUE_DEPTH = 0;
+	std::atomic<long long int> WORKER_QUEUE_PEAK = 0;
+	std::atomic<long long int> WORKER_TASKS = 0;
+	std::atomic<long long int> WORKER_WAIT_TOTAL_US = 0;
+	std::atomic<long long int> WORKER_WAIT_MAX_US = 0;
+
+	std::atomic<long long int> PORT_CACHE_HITS = 0;
+	std::atomic<long long int> PORT_CACHE_MISSES = 0;
+	std::atomic<long long int> PORT_CACHE_INVALIDATIONS = 0;
+
+	std::atomic<long long int> PEER_CONNECTS = 0;
+	std::atomic<long long int> PEER_REUSES = 0;
+	std::atomic<long long int> PEER_EVICTIONS = 0;
+	std::atomic<long long int> PEER_LINKS = 0;
+	std::atomic<long long int> PEER_MULTIPLEXED = 0;
+
+	std::atomic<long long int> SCAN_PROBES = 0;
+	std::atomic<long long int> SCAN_BANKS_FOUND = 0;
+
+	std::atomic<long long int> DIRECTORY_BANKS = 0;
+	std::atomic<long long int> CRAWL_ROUNDS = 0;
+
+	std::atomic<long long int> GOSSIP_BANKS = 0;
+	std::atomic<long long int> GOSSIP_ROUNDS = 0;
+	std::atomic<long long int> GOSSIP_EXCHANGES = 0;
+	std::atomic<long long int> GOSSIP_FAILURES = 0;
+
+	std::atomic<long long int> DISCOVERY_BANKS = 0;
+	std::atomic<long long int> DISCOVERY_ANNOUNCEMENTS = 0;
+
+	std::atomic<long long int> BREAKER_OPEN = 0;
+	std::atomic<long long int> BREAKER_REJECTIONS = 0;
+	std::atomic<long long int> BREAKER_PROBES = 0;
+
+	std::atomic<long long int> HEDGES_FIRED = 0;
+	std::atomic<long long int> HEDGES_WON = 0;
+
+	std::atomic<long long int> DB_COMMITS = 0;
+	std::atomic<long long int> DB_CHANGES = 0;
+	std::atomic<long long int> DB_COMMIT_FAILURES = 0;
+}
+
+std::string statsReport()
+{
+	std::string res;
+	res += "connections_open: " + std::to_string(stats::CONNECTIONS_OPEN) + "\n";
+	res += "connections_accepted: " + std::to_string(stats::CONNECTIONS_ACCEPTED) + "\n";
+	res += "connections_shed: " + std::to_string(stats::CONNECTIONS_SHED) + "\n";
+	res += "requests_handled: " + std::to_string(stats::REQUESTS_HANDLED) + "\n";
+	res += "requests_shed: " + std::to_string(stats::REQUESTS_SHED) + "\n";
+	res += "requests_timed_out: " + std::to_string(stats::REQUESTS_TIMED_OUT) + "\n";
+	res += "worker_queue_depth: " + std::to_string(stats::WORKER_QUEUE_DEPTH) + "\n";
+	res += "worker_queue_peak: " + std::to_string(stats::WORKER_QUEUE_PEAK) + "\n";
+	res += "worker_tasks: " + std::to_string(stats::WORKER_TASKS) + "\n";
+	long long int tasks = stats::WORKER_TASKS;
+	res += "worker_wait_avg_us: " + std::to_string(tasks > 0 ? stats::WORKER_WAIT_TOTAL_US / tasks : 0) + "\n";
+	res += "worker_wait_max_us: " + std::to_string(stats::WORKER_WAIT_MAX_US) + "\n";
+	res += "port_cache_hits: " + std::to_string(stats::PORT_CACHE_HITS) + "\n";
+	res += "port_cache_misses: " + std::to_string(stats::PORT_CACHE_MISSES) + "\n";
+	res += "port_cache_invalidations: " + std::to_string(stats::PORT_CACHE_INVALIDATIONS) + "\n";
+	res += "peer_connects: " + std::to_string(stats::PEER_CONNECTS) + "\n";
+	res += "peer_reuses: " + std::to_string(stats::PEER_REUSES) + "\n";
+	res += "peer_evictions: " + std::to_string(stats::PEER_EVICTIONS) + "\n";
+	res += "peer_links: " + std::to_string(stats::PEER_LINKS) + "\n";
+	res += "peer_multiplexed: " + std::to_string(stats::PEER_MULTIPLEXED) + "\n";
+	res += "scan_probes: " + std::to_string(stats::SCAN_PROBES) + "\n";
+	res += "scan_banks_found: " + std::to_string(stats::SCAN_BANKS_FOUND) + "\n";
+	res += "directory_banks: " + std::to_string(stats::DIRECTORY_BANKS) + "\n";
+	res += "crawl_rounds: " + std::to_string(stats::CRAWL_ROUNDS) + "\n";
+	res += "gossip_banks: " + std::to_string(stats::GOSSIP_BANKS) + "\n";
+	res += "gossip_rounds: " + std::to_string(stats::GOSSIP_ROUNDS) + "\n";
+	res += "gossip_exchanges: " + std::to_string(stats::GOSSIP_EXCHANGES) + "\n";
+	res += "gossip_failures: " + std::to_string(stats::GOSSIP_FAILURES) + "\n";
+	res += "discovery_banks: " + std::to_string(stats::DISCOVERY_BANKS) + "\n";
+	res += "discovery_announcements: " + std::to_string(stats::DISCOVERY_ANNOUNCEMENTS) + "\n";
+	res += "breaker_open: " + std::to_string(stats::BREAKER_OPEN) + "\n";
+	res += "breaker_rejections: " + std::to_string(stats::BREAKER_REJECTIONS) + "\n";
+	res += "breaker_probes: " + std::to_string(stats::BREAKER_PROBES) + "\n";
+	res += "hedges_fired: " + std::to_string(stats::HEDGES_FIRED) + "\n";
+	res += "hedges_won: " + std::to_string(stats::HEDGES_WON) + "\n";
+	res += "db_commits: " + std::to_string(stats::DB_COMMITS) + "\n";
+	res += "db_changes: " + std::to_string(stats::DB_CHANGES) + "\n";
+	res += "db_commit_failures: " + std::to_string(stats::DB_COMMIT_FAILURES) + "\n";
+	return res;
+}
@@ -0,0 +1,103 @@
+#include "workerpool.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+
+void workerThread(WorkerPool* pool)
+{
+	pool->work();
+}
+
+WorkerPool::WorkerPool()
+{
+	running = true;
+	workers.reserve(config::WORKER_THREADS);
+	for (int index = 0; index < config::WORKER_THREADS; ++index)
+	{
+		workers.emplace_back(workerThread, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::work()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(tasksLocker);
+		tasksCondition.wait(lock, [this]()
+		{
+			return !tasks.empty() || !running;
+		});
+		if (!running)
+		{
+			return;
+		}
+		Task task = std::move(tasks.front());
+		tasks.pop_front();
+		stats::WORKER_QUEUE_DEPTH = tasks.size();
+		lock.unlock();
+
+		long long int waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - task.queued).count();
+		++stats::WORKER_TASKS;
+		stats::WORKER_WAIT_TOTAL_US += waited;
+		long long int longest = stats::WORKER_WAIT_MAX_US;
+		while (waited > longest && !stats::WORKER_WAIT_MAX_US.compare_exchange_weak(longest, waited)) {}
+
+		try
+		{
+			task.work();
+		}
+		catch (const std::exception& e)
+		{
+			runtime_log.log((std::string)"Unhandled error in worker thread: " + e.what(), LOG_ERROR);
+		}
+	}
+}
+
+bool WorkerPool::submit(std::function<void()> task)
+{
+	tasksLocker.lock();
+	if (!running || tasks.size() >= (size_t)config::WORKER_QUEUE)
+	{
+		tasksLocker.unlock();
+		return false;
+	}
+	tasks.push_back({ std::move(task), std::chrono::steady_clock::now() });
+	long long int depth = tasks.size();
+	stats::WORKER_QUEUE_DEPTH = depth;
+	if (depth > stats::WORKER_QUEUE_PEAK) stats::WORKER_QUEUE_PEAK = depth;
+	tasksLocker.unlock();
+	tasksCondition.notify_one();
+	return true;
+}
+
+void WorkerPool::stop()
+{
+	tasksLocker.lock();
+	if (!running)
+	{
+		tasksLocker.unlock();
+		return;
+	}
+	running = false;
+	tasks.clear();
+	tasksLocker.unlock();
+	tasksCondition.notify_all();
+	for (auto& t : workers)
+	{
+		if (t.joinable()) t.join();
+	}
+	workers.clear();
+}
+
+std::shared_ptr<WorkerPool> WorkerPool::_instance;
+
+std::shared_ptr<WorkerPool> WorkerPool::instance()
+{
+	if (_instance == nullptr) _instance.reset(new WorkerPool);
+	return _instance;
+}